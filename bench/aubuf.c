@@ -0,0 +1,162 @@
+/**
+ * @file bench/aubuf.c  Microbenchmarks -- audio buffer
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include <rem_aubuf.h>
+#include <rem_deadline.h>
+#include "bench.h"
+
+
+/*
+ * One packet written and one packet read, with the buffer at its wish
+ * size, for the list and the ring mode. Both modes must read the same
+ * samples, also when the first read is larger than the buffered audio.
+ */
+
+
+enum {
+	FRAME_MAX = 3840,   /* 48000 Hz, 20 ms, stereo */
+	CHECKC    = 64,
+};
+
+
+static uint8_t inv[FRAME_MAX];
+static uint8_t outv[FRAME_MAX * 2];
+
+
+static int buf_alloc(struct aubuf **abp, bool ring, size_t min_sz,
+		     size_t max_sz)
+{
+	if (ring)
+		return aubuf_alloc_ring(abp, min_sz, max_sz);
+	else
+		return aubuf_alloc(abp, min_sz, max_sz);
+}
+
+
+/*
+ * Read twice the buffered audio when it reaches the wish size, and then
+ * read back a counting sequence
+ */
+static int check(bool ring, size_t sz)
+{
+	struct aubuf *ab;
+	uint16_t v = 0, w = 0;
+	size_t i, j;
+	int err;
+
+	err = buf_alloc(&ab, ring, sz, sz * 12);
+	if (err)
+		return err;
+
+	aubuf_write(ab, inv, sz);
+	aubuf_read(ab, outv, sz * 2);
+
+	if (aubuf_cur_size(ab) != sz) {
+		err = EBADMSG;
+		goto out;
+	}
+
+	aubuf_flush(ab);
+
+	for (i=0; i<CHECKC; i++) {
+
+		uint16_t *p = (uint16_t *)(void *)outv;
+
+		for (j=0; j<sz/2; j++)
+			p[j] = v++;
+
+		aubuf_write(ab, outv, sz);
+
+		if (i < 2)
+			continue;
+
+		aubuf_read(ab, outv, sz);
+
+		for (j=0; j<sz/2; j++) {
+			if (p[j] != w++) {
+				err = EBADMSG;
+				goto out;
+			}
+		}
+	}
+
+ out:
+	mem_deref(ab);
+
+	return err;
+}
+
+
+/* Average time of one write and one read in [ns], or 0 on error */
+static uint64_t packet_time(bool ring, size_t sz)
+{
+	struct aubuf *ab;
+	uint64_t t0, t;
+	uint32_t packets = 0;
+
+	if (buf_alloc(&ab, ring, sz * 2, sz * 12))
+		return 0;
+
+	aubuf_write(ab, inv, sz);
+	aubuf_write(ab, inv, sz);
+
+	t0 = deadline_now();
+
+	do {
+		aubuf_write(ab, inv, sz);
+		aubuf_read(ab, outv, sz);
+		++packets;
+		t = deadline_now() - t0;
+	} while (t < BENCH_TIME);
+
+	mem_deref(ab);
+
+	return t / packets;
+}
+
+
+/**
+ * Measure the audio buffer, list against ring mode
+ *
+ * @return 0 if success, EBADMSG if a mode reads the wrong samples
+ */
+int bench_aubuf(void)
+{
+	static const size_t szv[] = {320, 1920, FRAME_MAX};
+	size_t i;
+	int err = 0;
+
+	memset(inv, 0x55, sizeof(inv));
+
+	(void)re_printf("aubuf: one packet written and read, in [ns]"
+			" (speedup over list)\n");
+
+	for (i=0; i<ARRAY_SIZE(szv); i++) {
+
+		const size_t sz = szv[i];
+		uint64_t tl, tr;
+
+		(void)re_printf("  %4zu bytes", sz);
+
+		if (check(false, sz) || check(true, sz)) {
+			(void)re_printf(" wrong samples read\n");
+			err = EBADMSG;
+			continue;
+		}
+
+		tl = packet_time(false, sz);
+		tr = packet_time(true, sz);
+		if (!tl || !tr)
+			return ENOMEM;
+
+		(void)re_printf("  list %6llu  ring %6llu (%.1fx)\n",
+				tl, tr, (double)tl / tr);
+	}
+
+	return err;
+}
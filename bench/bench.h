@@ -0,0 +1,15 @@
+/**
+ * @file bench/bench.h  Microbenchmarks -- internal API
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/** Minimum run time of one measurement in [ns] */
+#define BENCH_TIME 200000000ULL
+
+
+int bench_fir(void);
+int bench_mix(void);
+int bench_aubuf(void);
+int bench_resamp(void);
@@ -0,0 +1,191 @@
+/**
+ * @file bench/fir.c  Microbenchmarks -- FIR kernels
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include <rem_fir.h>
+#include <rem_deadline.h>
+#include "fir/fir.h"
+#include "bench.h"
+
+
+/*
+ * The dot product and the filter of each kernel that the CPU supports,
+ * which must be bit-identical to the C kernel. The dot product is also
+ * used by the resampler, with the tap counts of its quality levels.
+ */
+
+
+enum {
+	FRAME  = 960,    /* 48000 Hz, 20 ms, mono */
+	TAPMAX = FIR_MAX_TAPS,
+	CH     = 2,
+};
+
+
+static int16_t inv[FRAME * CH];
+static int16_t outv[FRAME * CH];
+static int16_t refv[FRAME * CH];
+static int16_t tapv[TAPMAX];
+static int16_t histv[2 * FIR_MAX_TAPS];
+static int64_t sum;
+
+
+static uint32_t rnd(uint32_t *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+
+	return *seed >> 16;
+}
+
+
+/* Taps that sum to at most 2.0 in Q15, as the kernels require */
+static void taps_init(uint32_t *seed, size_t n)
+{
+	const uint32_t lim = min(65536 / n, 32767);
+	size_t i;
+
+	for (i=0; i<n; i++)
+		tapv[i] = (int16_t)((int32_t)(rnd(seed) % (2*lim + 1)) - lim);
+}
+
+
+static size_t filter(const struct fir_kern *kern, size_t tapc)
+{
+	const size_t s = FIR_MAX_TAPS / CH;
+	size_t p = 0;
+	unsigned c;
+
+	memset(histv, 0, sizeof(histv));
+
+	for (c=0; c<CH; c++) {
+		p = kern->filter(&histv[c * 2 * s], s, s - 1, outv + c,
+				 inv + c, FRAME, CH, tapv, tapc);
+	}
+
+	return p;
+}
+
+
+/* Returns EBADMSG if a kernel differs from the C kernel */
+static int check(const struct fir_kern *kern)
+{
+	uint32_t seed = 1;
+	size_t n;
+
+	for (n=1; n<=TAPMAX; n++) {
+
+		const int16_t *x = &inv[rnd(&seed) % (FRAME * CH - n)];
+
+		taps_init(&seed, n);
+
+		if (kern->dot(x, tapv, n) != fir_kern_c.dot(x, tapv, n))
+			return EBADMSG;
+
+		if (n > TAPMAX / CH)
+			continue;
+
+		filter(&fir_kern_c, n);
+		memcpy(refv, outv, sizeof(refv));
+		filter(kern, n);
+
+		if (memcmp(outv, refv, sizeof(refv)))
+			return EBADMSG;
+	}
+
+	return 0;
+}
+
+
+/* Average time of FRAME dot products in [ns] */
+static uint64_t dot_time(const struct fir_kern *kern, size_t tapc)
+{
+	uint64_t t0, t;
+	uint32_t runs = 0;
+	size_t i;
+
+	t0 = deadline_now();
+
+	do {
+		for (i=0; i<FRAME; i++)
+			sum += kern->dot(&inv[i], tapv, tapc);
+
+		++runs;
+		t = deadline_now() - t0;
+	} while (t < BENCH_TIME);
+
+	return t / runs;
+}
+
+
+/**
+ * Check and measure the FIR kernels that the CPU supports
+ *
+ * @return 0 if success, EBADMSG if a kernel differs from the C kernel
+ */
+int bench_fir(void)
+{
+	static const size_t tapv_n[] = {16, 32, 64, 192, 256};
+	const struct fir_kern *kernv[4];
+	uint32_t seed = 1;
+	size_t i, k, kernc = 0;
+	int err = 0;
+
+	kernv[kernc++] = &fir_kern_c;
+
+#ifdef FIR_KERN_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse2"))
+		kernv[kernc++] = &fir_kern_sse2;
+	if (__builtin_cpu_supports("avx2"))
+		kernv[kernc++] = &fir_kern_avx2;
+#endif
+#ifdef HAVE_NEON
+	kernv[kernc++] = &fir_kern_neon;
+#endif
+
+	/* full scale, so that the 32-bit lanes are at their limit */
+	for (i=0; i<ARRAY_SIZE(inv); i++)
+		inv[i] = (int16_t)rnd(&seed);
+
+	for (k=1; k<kernc; k++) {
+
+		if (check(kernv[k])) {
+			(void)re_printf("fir: %s differs from c\n",
+					kernv[k]->name);
+			err = EBADMSG;
+		}
+	}
+
+	(void)re_printf("fir: %u dot products, in [us]"
+			" (speedup over c)\n", FRAME);
+
+	for (i=0; i<ARRAY_SIZE(tapv_n); i++) {
+
+		const size_t n = tapv_n[i];
+		uint64_t ref = 0;
+
+		taps_init(&seed, n);
+
+		(void)re_printf("  taps=%-4u", (unsigned)n);
+
+		for (k=0; k<kernc; k++) {
+
+			const uint64_t t = dot_time(kernv[k], n);
+
+			if (!k)
+				ref = t;
+
+			(void)re_printf(" %5s %7.1f (%.1fx)", kernv[k]->name,
+					t / 1000.0, (double)ref / t);
+		}
+
+		(void)re_printf("\n");
+	}
+
+	return err;
+}
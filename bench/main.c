@@ -0,0 +1,29 @@
+/**
+ * @file bench/main.c  Microbenchmarks
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <re.h>
+#include "bench.h"
+
+
+/*
+ * Run with "make bench". The numbers are for one core, and depend on
+ * the CPU and the compiler flags of the library.
+ */
+
+
+int main(void)
+{
+	int err = 0;
+
+#ifdef HAVE_PTHREAD
+	err |= bench_mix();
+#endif
+	err |= bench_fir();
+	err |= bench_aubuf();
+	err |= bench_resamp();
+
+	return err ? 1 : 0;
+}
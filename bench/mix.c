@@ -0,0 +1,163 @@
+/**
+ * @file bench/mix.c  Microbenchmarks -- mix bus kernels
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include <rem_deadline.h>
+#include "aumix/aumix.h"
+#include "bench.h"
+
+
+/*
+ * One mixer tick with N sources: the bus is initialized, every source
+ * is added, and every listener gets the bus minus its own source. The
+ * output of each kernel set must be bit-identical to the C reference.
+ *
+ * The speedup is over the per-listener loop that the mixer used before
+ * the mix bus, which adds all other sources for each listener.
+ */
+
+
+enum {
+	FRAME  = 960,    /* 48000 Hz, 20 ms, mono */
+	SRCMAX = 200,
+};
+
+
+static int16_t srcv[SRCMAX][FRAME];
+static int16_t outv[SRCMAX][FRAME];
+static int16_t refv[SRCMAX][FRAME];
+static int32_t bus[FRAME];
+
+
+/* O(N^2) sample adds per tick, wrapping around on overflow */
+static void tick_loop(unsigned n)
+{
+	unsigned i, j;
+	size_t k;
+
+	for (i=0; i<n; i++) {
+
+		memset(outv[i], 0, sizeof(outv[i]));
+
+		for (j=0; j<n; j++) {
+
+			/* skip self */
+			if (j == i)
+				continue;
+
+			for (k=0; k<FRAME; k++)
+				outv[i][k] += srcv[j][k];
+		}
+	}
+}
+
+
+static void tick(const struct aumix_kern *kern, unsigned n)
+{
+	unsigned i;
+
+	if (!kern) {
+		tick_loop(n);
+		return;
+	}
+
+	kern->bus_init(bus, NULL, FRAME);
+
+	for (i=0; i<n; i++)
+		kern->bus_add(bus, srcv[i], FRAME);
+
+	for (i=0; i<n; i++)
+		kern->bus_get_minus(outv[i], bus, srcv[i], FRAME);
+}
+
+
+/* Average time of one tick in [ns] */
+static uint64_t tick_time(const struct aumix_kern *kern, unsigned n)
+{
+	uint64_t t0, t;
+	uint32_t ticks = 0;
+
+	t0 = deadline_now();
+
+	do {
+		tick(kern, n);
+		++ticks;
+		t = deadline_now() - t0;
+	} while (t < BENCH_TIME);
+
+	return t / ticks;
+}
+
+
+/**
+ * Measure the mix bus kernels that the CPU supports
+ *
+ * @return 0 if success, EBADMSG if a kernel differs from the reference
+ */
+int bench_mix(void)
+{
+	static const unsigned nv[] = {10, 50, 200};
+	const struct aumix_kern *kernv[4];
+	uint32_t seed = 1;
+	size_t i, j, k, kernc = 0;
+	int err = 0;
+
+	kernv[kernc++] = &aumix_kern_c;
+
+#ifdef AUMIX_KERN_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse2"))
+		kernv[kernc++] = &aumix_kern_sse2;
+	if (__builtin_cpu_supports("avx2"))
+		kernv[kernc++] = &aumix_kern_avx2;
+#endif
+#ifdef HAVE_NEON
+	kernv[kernc++] = &aumix_kern_neon;
+#endif
+
+	/* loud sources, so that the mix-minus saturates */
+	for (i=0; i<SRCMAX; i++) {
+		for (j=0; j<FRAME; j++) {
+			seed = seed * 1103515245 + 12345;
+			srcv[i][j] = (int16_t)(seed >> 16);
+		}
+	}
+
+	(void)re_printf("aumix: one tick of %u samples, in [us]"
+			" (speedup over the per-listener loop)\n", FRAME);
+
+	for (i=0; i<ARRAY_SIZE(nv); i++) {
+
+		const unsigned n = nv[i];
+		const uint64_t ref = tick_time(NULL, n);
+
+		(void)re_printf("  N=%-4u loop %7.1f", n, ref / 1000.0);
+
+		tick(&aumix_kern_c, n);
+		memcpy(refv, outv, sizeof(refv));
+
+		for (k=0; k<kernc; k++) {
+
+			const uint64_t t = tick_time(kernv[k], n);
+
+			if (memcmp(outv, refv, n * sizeof(outv[0]))) {
+				(void)re_printf(" %s: differs from c",
+						kernv[k]->name);
+				err = EBADMSG;
+				continue;
+			}
+
+			(void)re_printf(" %5s %7.1f (%.1fx)", kernv[k]->name,
+					t / 1000.0, (double)ref / t);
+		}
+
+		(void)re_printf("\n");
+	}
+
+	return err;
+}
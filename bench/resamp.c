@@ -0,0 +1,144 @@
+/**
+ * @file bench/resamp.c  Microbenchmarks -- audio resampler
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <math.h>
+#include <re.h>
+#include <rem_auresamp.h>
+#include <rem_deadline.h>
+#include "bench.h"
+
+
+/*
+ * Throughput of the resampler for common rate pairs, in input samples
+ * per second (all channels), with 20 ms blocks.
+ */
+
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+enum {
+	RATE_MAX = 48000,
+	CH_MAX   = 2,
+	BLOCK    = RATE_MAX / 50 * CH_MAX,
+};
+
+
+static const struct {
+	uint32_t irate, orate;
+} ratev[] = {
+	{44100, 48000},
+	{48000, 44100},
+	{48000, 32000},
+	{32000, 48000},
+	{48000, 16000},
+	{16000, 48000},
+	{48000,  8000},
+	{ 8000, 48000},
+};
+
+/* the rate pairs of the quality levels */
+static const struct {
+	uint32_t irate, orate;
+} qratev[] = {
+	{44100, 48000},
+	{48000,  8000},
+	{ 8000, 48000},
+};
+
+static int16_t inv[BLOCK];
+static int16_t outv[BLOCK * 6];
+
+
+/* Input samples per second, or 0 on error */
+static double throughput(uint32_t irate, uint32_t orate, unsigned ch,
+			 enum auresamp_quality q)
+{
+	const size_t inc = irate / 50 * ch;
+	struct auresamp rs;
+	uint64_t t0, t = 0, sampc = 0;
+
+	auresamp_init(&rs);
+
+	if (auresamp_set_quality(&rs, q) ||
+	    auresamp_setup(&rs, irate, ch, orate, ch))
+		goto out;
+
+	t0 = deadline_now();
+
+	do {
+		size_t outc = ARRAY_SIZE(outv);
+
+		if (auresamp(&rs, outv, &outc, inv, inc)) {
+			sampc = 0;
+			break;
+		}
+
+		sampc += inc;
+		t = deadline_now() - t0;
+	} while (t < BENCH_TIME);
+
+ out:
+	auresamp_reset(&rs);
+
+	return sampc ? sampc * 1e9 / t : 0;
+}
+
+
+/**
+ * Measure the resampler throughput, mono and stereo, and of each quality
+ * level
+ *
+ * @return 0 if success, otherwise error code
+ */
+int bench_resamp(void)
+{
+	size_t i;
+
+	for (i=0; i<BLOCK; i++)
+		inv[i] = (int16_t)(16000 * sin(2 * M_PI * 1000 * i / 48000));
+
+	(void)re_printf("auresamp: 20 ms blocks, medium quality,"
+			" in [Msamples/s] (mono / stereo)\n");
+
+	for (i=0; i<ARRAY_SIZE(ratev); i++) {
+
+		const uint32_t ir = ratev[i].irate, orr = ratev[i].orate;
+		const enum auresamp_quality q = AURESAMP_QUALITY_MEDIUM;
+		const double m = throughput(ir, orr, 1, q);
+		const double s = throughput(ir, orr, 2, q);
+
+		if (!m || !s)
+			return EINVAL;
+
+		(void)re_printf("  %5u -> %5u %7.1f / %5.1f\n",
+				ir, orr, m / 1e6, s / 1e6);
+	}
+
+	(void)re_printf("auresamp: quality levels, mono, in [Msamples/s]"
+			" (low / medium / high)\n");
+
+	for (i=0; i<ARRAY_SIZE(qratev); i++) {
+
+		const uint32_t ir = qratev[i].irate, orr = qratev[i].orate;
+		double t[3];
+		unsigned q;
+
+		for (q=0; q<ARRAY_SIZE(t); q++) {
+
+			t[q] = throughput(ir, orr, 1, q);
+			if (!t[q])
+				return EINVAL;
+		}
+
+		(void)re_printf("  %5u -> %5u %7.1f / %5.1f / %5.1f\n",
+				ir, orr, t[0] / 1e6, t[1] / 1e6, t[2] / 1e6);
+	}
+
+	return 0;
+}
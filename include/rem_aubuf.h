@@ -6,14 +6,70 @@
 
 struct aubuf;
 
+/** Audio buffer mode */
+enum aubuf_mode {
+	AUBUF_FIXED = 0,   /**< Fixed size, from min_sz            */
+	AUBUF_ADAPTIVE,    /**< Adaptive size, with time-stretching */
+};
+
+/** Contiguous span of buffered audio */
+struct aubuf_span {
+	const uint8_t *p;    /**< Start of the span         */
+	size_t sz;           /**< Size of the span [bytes]  */
+};
+
+/** Number of bins in the fill level histogram */
+#define AUBUF_HIST_BINS 16
+
+/** Audio buffer statistics */
+struct aubuf_stats {
+	uint64_t bytes_in;   /**< Bytes written                        */
+	uint64_t bytes_out;  /**< Bytes read, without silence          */
+	uint64_t dropped;    /**< Bytes dropped on overrun             */
+	uint32_t overrun;    /**< Number of overruns                   */
+	uint32_t underrun;   /**< Number of underruns                  */
+	uint32_t late;       /**< Late or duplicate frames dropped     */
+	int32_t drift;       /**< Clock drift estimate [ppm]           */
+	uint32_t drift_ins;  /**< Samples inserted for clock drift     */
+	uint32_t drift_rem;  /**< Samples removed for clock drift      */
+	size_t fill_min;     /**< Minimum fill level at read [bytes]   */
+	size_t fill_max;     /**< Maximum fill level at read [bytes]   */
+	size_t fill_avg;     /**< Average fill level at read [bytes]   */
+	size_t hist_step;    /**< Width of a histogram bin [bytes]     */
+	uint32_t histv[AUBUF_HIST_BINS];  /**< Reads per fill level   */
+};
+
+/** Statistics of the adaptive mode */
+struct aubuf_adaptive {
+	uint32_t delay;      /**< Current delay [ms]              */
+	uint32_t target;     /**< Target delay [ms]               */
+	uint32_t jitter;     /**< Arrival jitter estimate [ms]    */
+	uint32_t accel;      /**< Number of accelerate operations */
+	uint32_t expand;     /**< Number of expand operations     */
+	uint32_t accel_ms;   /**< Total audio removed [ms]        */
+	uint32_t expand_ms;  /**< Total audio inserted [ms]       */
+};
+
 int  aubuf_alloc(struct aubuf **abp, size_t min_sz, size_t max_sz);
+int  aubuf_alloc_ring(struct aubuf **abp, size_t min_sz, size_t max_sz);
 int  aubuf_append(struct aubuf *ab, struct mbuf *mb);
 int  aubuf_write(struct aubuf *ab, const uint8_t *p, size_t sz);
+int  aubuf_append_ts(struct aubuf *ab, struct mbuf *mb, uint32_t ts);
+int  aubuf_write_ts(struct aubuf *ab, const uint8_t *p, size_t sz,
+		    uint32_t ts);
 void aubuf_read(struct aubuf *ab, uint8_t *p, size_t sz);
 int  aubuf_get(struct aubuf *ab, uint32_t ptime, uint8_t *p, size_t sz);
+int  aubuf_peek(struct aubuf *ab, size_t sz, struct aubuf_span spanv[2]);
+void aubuf_consume(struct aubuf *ab, size_t sz);
 void aubuf_flush(struct aubuf *ab);
 int  aubuf_debug(struct re_printf *pf, const struct aubuf *ab);
 size_t aubuf_cur_size(const struct aubuf *ab);
+int  aubuf_set_format(struct aubuf *ab, uint32_t srate, uint8_t ch);
+int  aubuf_set_mode(struct aubuf *ab, enum aubuf_mode mode);
+int  aubuf_set_plc(struct aubuf *ab, bool enable);
+int  aubuf_set_drift(struct aubuf *ab, bool enable);
+int  aubuf_stats(const struct aubuf *ab, struct aubuf_stats *st);
+int  aubuf_adaptive_stats(const struct aubuf *ab, struct aubuf_adaptive *st);
 
 
 static inline int aubuf_write_samp(struct aubuf *ab, const int16_t *sampv,
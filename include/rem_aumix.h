@@ -19,10 +19,22 @@ typedef void (aumix_frame_h)(const int16_t *sampv, size_t sampc, void *arg);
 int aumix_alloc(struct aumix **mixp, uint32_t srate,
 		uint8_t ch, uint32_t ptime);
 int aumix_playfile(struct aumix *mix, const char *filepath);
+int aumix_set_workers(struct aumix *mix, unsigned n);
+int aumix_set_topk(struct aumix *mix, uint32_t k, uint32_t hold);
+uint32_t aumix_speakers(struct aumix *mix, struct aumix_source **srcv,
+			uint32_t srcc);
+int aumix_debug(struct re_printf *pf, struct aumix *mix);
 uint32_t aumix_source_count(const struct aumix *mix);
 int aumix_source_alloc(struct aumix_source **srcp, struct aumix *mix,
 		       aumix_frame_h *fh, void *arg);
+int  aumix_source_set_format(struct aumix_source *src, uint32_t srate,
+			     uint8_t ch);
 void aumix_source_enable(struct aumix_source *src, bool enable);
+void aumix_source_set_recvonly(struct aumix_source *src, bool recvonly);
+void aumix_source_set_gain(struct aumix_source *src, float gain);
+void aumix_source_mute(struct aumix_source *src, bool mute);
+void aumix_source_set_pan(struct aumix_source *src, float pan);
+void aumix_source_set_vad(struct aumix_source *src, bool active);
 int  aumix_source_put(struct aumix_source *src, const int16_t *sampv,
 		      size_t sampc);
 void aumix_source_flush(struct aumix_source *src);
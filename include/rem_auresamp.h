@@ -4,31 +4,73 @@
  * Copyright (C) 2010 Creytiv.com
  */
 
+struct auresamp;
+struct auresamp_poly;
+
 /**
- * Defines the audio resampler handler
+ * Defines the channel remix handler
  *
- * @param outv  Output samples
- * @param inv   Input samples
- * @param inc   Number of input samples
- * @param ratio Resample ratio
+ * @param rs   Resampler, with the remix matrix
+ * @param outv Output frames
+ * @param inv  Input frames
+ * @param n    Number of frames
  */
-typedef void (auresamp_h)(int16_t *outv, const int16_t *inv,
-			  size_t inc, unsigned ratio);
+typedef void (auresamp_h)(const struct auresamp *rs, int16_t *outv,
+			  const int16_t *inv, size_t n);
+
+/** Maximum number of taps per phase of the polyphase filter */
+#define AURESAMP_POLY_TAPS 256
+
+/** Maximum number of input or output channels */
+#define AURESAMP_MAX_CH    8
+
+/** Remix gain of 1.0, the remix matrix is in Q14 */
+#define AURESAMP_GAIN_UNITY 16384
+
+/**
+ * Resampler quality, a longer filter gives a sharper cutoff and a
+ * better stopband, at a higher CPU cost
+ *
+ * The filter has zc zero crossings on each side at the lower rate, so
+ * there are 2 * zc * max(L, M) / L taps per phase, at most
+ * AURESAMP_POLY_TAPS. That is 2 * zc when upsampling, and M / L times
+ * more when downsampling, e.g. 192 taps for medium from 48 to 8 kHz.
+ */
+enum auresamp_quality {
+	AURESAMP_QUALITY_LOW = 0,  /**< zc = 8, 50 dB           */
+	AURESAMP_QUALITY_MEDIUM,   /**< zc = 16, 70 dB, default */
+	AURESAMP_QUALITY_HIGH,     /**< zc = 32, 90 dB          */
+};
 
 /** Defines the resampler state */
 struct auresamp {
-	struct fir fir;        /**< FIR filter state */
-	auresamp_h *resample;  /**< Resample handler */
-	const int16_t *tapv;   /**< FIR filter taps */
-	size_t tapc;           /**< FIR filter tap count */
+	auresamp_h *resample;  /**< Channel remix handler, set if active */
 	uint32_t orate, irate; /**< Input/output sample rate */
 	unsigned och, ich;     /**< Input/output channel count */
-	unsigned ratio;        /**< Resample ratio */
+	unsigned ratio;        /**< Resample ratio, the larger of L and M */
 	bool up;               /**< Up/down sample flag */
+	enum auresamp_quality quality; /**< Filter quality */
+
+	/* L/M polyphase resampling */
+	struct auresamp_poly *poly; /**< Shared polyphase filter */
+	const int16_t *polyv;  /**< Polyphase filter taps, L x polyc */
+	size_t polyc;          /**< Polyphase filter taps per phase */
+	unsigned l, m;         /**< Interpolation/decimation factor */
+	unsigned phase;        /**< Phase of the next output */
+	size_t pos;            /**< Input frame of the next output */
+	int16_t *histv;        /**< Input of each filtered channel */
+
+	/* Channel remixing */
+	int16_t mixv[AURESAMP_MAX_CH * AURESAMP_MAX_CH]; /**< och x ich
+							  gains, Q14 */
+	bool mixed;            /**< Remix matrix is not the identity */
 };
 
 void auresamp_init(struct auresamp *rs);
+void auresamp_reset(struct auresamp *rs);
 int  auresamp_setup(struct auresamp *rs, uint32_t irate, unsigned ich,
 		    uint32_t orate, unsigned och);
+int  auresamp_set_quality(struct auresamp *rs, enum auresamp_quality q);
+int  auresamp_set_matrix(struct auresamp *rs, const int16_t *mixv);
 int  auresamp(struct auresamp *rs, int16_t *outv, size_t *outc,
 	      const int16_t *inv, size_t inc);
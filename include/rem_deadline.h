@@ -0,0 +1,29 @@
+/**
+ * @file rem_deadline.h  Periodic deadline scheduler
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/**
+ * Defines a periodic deadline scheduler
+ *
+ * The scheduler sleeps until absolute deadlines on the monotonic clock,
+ * so that the period does not drift with the processing time or with
+ * coarse wakeups.
+ */
+struct deadline {
+	uint64_t next;      /**< Next deadline in [ns]               */
+	uint64_t period;    /**< Period in [ns]                      */
+	uint64_t ticks;     /**< Number of deadlines reached         */
+	uint64_t missed;    /**< Number of deadlines missed          */
+	uint64_t resyncs;   /**< Number of times the schedule slipped */
+	uint64_t late_sum;  /**< Sum of lateness in [ns]             */
+	uint64_t late_max;  /**< Maximum lateness in [ns]            */
+};
+
+uint64_t deadline_now(void);
+void     deadline_init(struct deadline *dl, uint64_t period);
+void     deadline_set_period(struct deadline *dl, uint64_t period);
+uint64_t deadline_wait(struct deadline *dl);
+int      deadline_debug(struct re_printf *pf, const struct deadline *dl);
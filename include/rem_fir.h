@@ -4,12 +4,24 @@
  * Copyright (C) 2010 Creytiv.com
  */
 
+/** Maximum number of taps times channels, it sets the size of struct fir */
+#define FIR_MAX_TAPS 256
+
 /** Defines the fir filter state */
 struct fir {
-	int16_t history[256];  /**< Previous samples */
-	unsigned index;        /**< Sample index */
+	int16_t history[2 * FIR_MAX_TAPS];  /**< Previous samples, twice */
+	unsigned index;                     /**< Sample index */
 };
 
+/**
+ * Defines the dot product of n samples and n taps
+ *
+ * The vector kernels sum in 32-bit lanes, so the taps that meet in one
+ * lane must not sum to more than 2.0 in Q15.
+ */
+typedef int64_t (fir_dot_h)(const int16_t *x, const int16_t *h, size_t n);
+
 void fir_reset(struct fir *fir);
 void fir_filter(struct fir *fir, int16_t *outv, const int16_t *inv, size_t inc,
 		unsigned ch, const int16_t *tapv, size_t tapc);
+fir_dot_h *fir_dot_get(void);
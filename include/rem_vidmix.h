@@ -30,6 +30,7 @@ int  vidmix_source_start(struct vidmix_source *src);
 void vidmix_source_stop(struct vidmix_source *src);
 int  vidmix_source_set_size(struct vidmix_source *src, const struct vidsz *sz);
 void vidmix_source_set_rate(struct vidmix_source *src, unsigned fps);
+int  vidmix_source_debug(struct re_printf *pf, struct vidmix_source *src);
 void vidmix_source_set_content_hide(struct vidmix_source *src, bool hide);
 void vidmix_source_toggle_selfview(struct vidmix_source *src);
 void vidmix_source_set_focus(struct vidmix_source *src,
@@ -6,33 +6,113 @@
 #include <string.h>
 #include <re.h>
 #include <rem_aubuf.h>
+#include "aubuf.h"
 
 
 #define AUBUF_DEBUG 0
 
 
-/** Locked audio-buffer with almost zero-copy */
+enum {
+	JB_RESET   = 1000000,  /* Re-anchor after a write gap [us]     */
+	JB_DECAY   = 256,      /* Jitter peak decay, in writes         */
+	JB_CREEP   = 1024,     /* Arrival floor creep, frame fraction  */
+
+	DRIFT_AVG  = 64,       /* Fill level average, in reads         */
+	DRIFT_WIN  = 256,      /* Drift estimation window, in reads    */
+	DRIFT_ONE  = 1 << 16,  /* One frame, in Q16                    */
+};
+
+
+/**
+ * Locked audio-buffer with almost zero-copy
+ *
+ * In ring mode, the audio is copied to a lock-free ring buffer instead,
+ * and the state below is owned by the reader.
+ */
 struct aubuf {
 	struct list afl;
 	struct lock *lock;
+	struct aubuf_ring *ring;
 	size_t wish_sz;
 	size_t cur_sz;
 	size_t max_sz;
 	bool filling;
 	uint64_t ts;
 
-#if AUBUF_DEBUG
+	/* timestamp order, list only */
+	bool ts_on;
+	uint32_t ts_rd;          /* timestamp of the read position */
+
+	/* adaptive mode */
+	enum aubuf_mode mode;
+	uint32_t srate;
+	uint8_t ch;
+
+	struct {                 /* writer side                   */
+		uint64_t t0;     /* arrival of first write [us]   */
+		uint64_t last;   /* arrival of last write [us]    */
+		uint64_t wr_sz;  /* bytes written since t0        */
+		int64_t floor;   /* lower envelope of skew [us]   */
+		int64_t jit;     /* arrival jitter [us]           */
+		uint32_t jit_ms; /* arrival jitter, published     */
+		size_t target;   /* target fill [bytes]           */
+	} jb;
+
+	int16_t *resv;           /* stretched samples, reader side */
+	size_t resn;             /* size of resv in samples        */
+	size_t res_sz;           /* bytes in resv                  */
+
+	struct aubuf_plc *plc;   /* packet loss concealment        */
+	bool plc_on;
+
+	struct mbuf *peekv[2];   /* frames held by aubuf_peek()    */
+	size_t peek_sz;          /* size of the first span         */
+
+	struct {                 /* clock drift, reader side       */
+		bool on;
+		uint32_t n;      /* reads since the reference      */
+		int64_t avg;     /* average fill [bytes, Q8]       */
+		int64_t ref;     /* reference fill [bytes, Q8]     */
+		int64_t last;    /* average at the last window     */
+		int64_t rate;    /* drift [frames per read, Q16]   */
+		int64_t acc;     /* pending change [frames, Q16]   */
+		int16_t *tmpv;
+		size_t tmpn;     /* size of tmpv in samples        */
+	} drift;
+
 	struct {
-		size_t or;
-		size_t ur;
+		size_t delay;
+		uint32_t accel;
+		uint32_t expand;
+		uint32_t accelc; /* frames removed  */
+		uint32_t expandc;/* frames inserted */
+	} jbstat;
+
+	struct {                 /* updated with relaxed atomics   */
+		uint64_t bytes_in;
+		uint64_t bytes_out;
+		uint64_t dropped;
+		uint32_t overrun;
+		uint32_t underrun;
+		uint32_t late;
+		int32_t drift;
+		uint32_t drift_ins;
+		uint32_t drift_rem;
+		uint64_t reads;      /* reader only below          */
+		uint64_t fill_sum;
+		size_t fill_min;
+		size_t fill_max;
+		uint32_t histv[AUBUF_HIST_BINS];
 	} stats;
-#endif
+	size_t hist_step;
 };
 
 
 struct auframe {
 	struct le le;
 	struct mbuf *mb;
+	uint32_t ts;       /* sample timestamp, in timestamp order */
+	uint32_t ts_end;
 };
 
 
@@ -50,10 +130,70 @@ static void aubuf_destructor(void *arg)
 	struct aubuf *ab = arg;
 
 	list_flush(&ab->afl);
+	mem_deref(ab->peekv[0]);
+	mem_deref(ab->peekv[1]);
+	mem_deref(ab->resv);
+	mem_deref(ab->drift.tmpv);
+	mem_deref(ab->plc);
+	mem_deref(ab->ring);
 	mem_deref(ab->lock);
 }
 
 
+/* Number of bytes per second */
+static inline uint64_t aubuf_bps(const struct aubuf *ab)
+{
+	return (uint64_t)ab->srate * ab->ch * 2;
+}
+
+
+/*
+ * Estimate the arrival jitter from the write timing, writer only
+ *
+ * The skew is the arrival time of a write, relative to the duration
+ * of the audio written before it. The jitter is the distance from the
+ * lower envelope of the skew, as a peak that decays slowly.
+ */
+static void jitter_update(struct aubuf *ab, size_t sz)
+{
+	const uint64_t bps = aubuf_bps(ab);
+	const uint64_t now = tmr_jiffies() * 1000;
+	const int64_t creep = (int64_t)(sz * 1000000 / bps / JB_CREEP);
+	int64_t skew, dev;
+	size_t target;
+
+	if (!ab->jb.t0 || now > ab->jb.last + JB_RESET) {
+		ab->jb.t0    = now;
+		ab->jb.wr_sz = 0;
+		ab->jb.floor = 0;
+	}
+
+	ab->jb.last = now;
+
+	skew = (int64_t)(now - ab->jb.t0) -
+		(int64_t)(ab->jb.wr_sz * 1000000 / bps);
+
+	ab->jb.wr_sz += sz;
+
+	ab->jb.floor = min(skew, ab->jb.floor + creep);
+
+	dev = skew - ab->jb.floor;
+	ab->jb.jit = max(dev, ab->jb.jit - ab->jb.jit / JB_DECAY);
+	AUBUF_STORE(&ab->jb.jit_ms, (uint32_t)(ab->jb.jit / 1000));
+
+	/* the jitter, plus one write */
+	target  = (size_t)((uint64_t)ab->jb.jit * bps / 1000000);
+	target -= target % (ab->ch * 2);
+	target += sz;
+
+	target = max(target, ab->wish_sz);
+	if (ab->max_sz)
+		target = min(target, ab->max_sz * 3 / 4);
+
+	AUBUF_STORE(&ab->jb.target, target);
+}
+
+
 /**
  * Allocate a new audio buffer
  *
@@ -83,6 +223,10 @@ int aubuf_alloc(struct aubuf **abp, size_t min_sz, size_t max_sz)
 	ab->max_sz = max_sz;
 	ab->filling = true;
 
+	ab->stats.fill_min = (size_t)-1;
+	ab->hist_step = max((max_sz ? max_sz : 4 * min_sz) / AUBUF_HIST_BINS,
+			    (size_t)1);
+
  out:
 	if (err)
 		mem_deref(ab);
@@ -94,251 +238,1355 @@ int aubuf_alloc(struct aubuf **abp, size_t min_sz, size_t max_sz)
 
 
 /**
- * Append a PCM-buffer to the end of the audio buffer
+ * Allocate a new audio buffer in ring mode
  *
- * @param ab Audio buffer
- * @param mb Mbuffer with PCM samples
+ * In ring mode, writing and reading is a copy to and from a
+ * preallocated ring buffer, without memory allocation and without
+ * locking. There must be only one writer thread and one reader thread.
+ * The audio buffer can be flushed from any thread.
+ *
+ * If the buffer holds more than the maximum size, the oldest samples are
+ * dropped by the next read. If the reader stalls, new samples are
+ * dropped when the ring buffer is full.
+ *
+ * @param abp    Pointer to allocated audio buffer
+ * @param min_sz Minimum buffer size
+ * @param max_sz Maximum buffer size
  *
  * @return 0 for success, otherwise error code
  */
-int aubuf_append(struct aubuf *ab, struct mbuf *mb)
+int aubuf_alloc_ring(struct aubuf **abp, size_t min_sz, size_t max_sz)
 {
-	struct auframe *af;
+	struct aubuf *ab;
+	int err;
 
-	if (!ab || !mb)
+	if (!abp || !max_sz)
 		return EINVAL;
 
-	af = mem_zalloc(sizeof(*af), auframe_destructor);
-	if (!af)
-		return ENOMEM;
+	err = aubuf_alloc(&ab, min_sz, max_sz);
+	if (err)
+		return err;
 
-	af->mb = mem_ref(mb);
+	err = aubuf_ring_alloc(&ab->ring, 2 * max_sz);
+	if (err)
+		mem_deref(ab);
+	else
+		*abp = ab;
 
-	lock_write_get(ab->lock);
+	return err;
+}
 
-	list_append(&ab->afl, &af->le, af);
-	ab->cur_sz += mbuf_get_left(mb);
 
-	if (ab->max_sz && ab->cur_sz > ab->max_sz) {
-#if AUBUF_DEBUG
-		++ab->stats.or;
-		(void)re_printf("aubuf: %p overrun (cur=%zu)\n",
-				ab, ab->cur_sz);
-#endif
-		af = list_ledata(ab->afl.head);
-		if (af) {
-			ab->cur_sz -= mbuf_get_left(af->mb);
-			mem_deref(af);
-		}
-	}
+/* Signed distance between two sample timestamps */
+static inline int32_t ts_diff(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b);
+}
 
-	lock_rel(ab->lock);
 
-	return 0;
+/* Timestamp at the end of the buffered audio, with the lock held */
+static uint32_t ts_tail(const struct aubuf *ab)
+{
+	const struct auframe *af = list_ledata(list_tail(&ab->afl));
+
+	return af ? af->ts_end : ab->ts_rd;
 }
 
 
-/**
- * Write PCM samples to the audio buffer
- *
- * @param ab Audio buffer
- * @param p  Pointer to PCM data
- * @param sz Number of bytes to write
- *
- * @return 0 for success, otherwise error code
- */
-int aubuf_write(struct aubuf *ab, const uint8_t *p, size_t sz)
+/* Start the timestamp order, the buffered audio is before ts */
+static void ts_start(struct aubuf *ab, uint32_t ts)
 {
-	struct mbuf *mb = mbuf_alloc(sz);
-	int err;
+	const size_t fsz = ab->ch * 2;
+	struct le *le;
 
-	if (!mb)
-		return ENOMEM;
+	ab->ts_rd = ts - (uint32_t)(ab->cur_sz / fsz);
+	ab->ts_on = true;
 
-	(void)mbuf_write_mem(mb, p, sz);
-	mb->pos = 0;
+	/* the buffered audio ends at ts */
+	ts = ab->ts_rd;
 
-	err = aubuf_append(ab, mb);
+	for (le=ab->afl.head; le; le=le->next) {
 
-	mem_deref(mb);
+		struct auframe *af = le->data;
 
-	return err;
+		af->ts  = ts;
+		ts     += (uint32_t)(mbuf_get_left(af->mb) / fsz);
+		af->ts_end = ts;
+	}
 }
 
 
-/**
- * Read PCM samples from the audio buffer. If there is not enough data
- * in the audio buffer, silence will be read.
+/*
+ * Insert a frame in timestamp order, with the lock held
  *
- * @param ab Audio buffer
- * @param p  Buffer where PCM samples are read into
- * @param sz Number of bytes to read
+ * In the common case, the frame follows the tail and the scan stops at
+ * once. A frame that is ahead of the tail leaves a gap, which is
+ * concealed when read, or filled by a reordered frame. A frame that
+ * jumps by more than the buffer size restarts the buffer.
+ *
+ * Returns false if the frame is late or a duplicate. The bytes that are
+ * dropped by a restart are added to dropped.
  */
-void aubuf_read(struct aubuf *ab, uint8_t *p, size_t sz)
+static bool ts_insert(struct aubuf *ab, struct auframe *af, size_t *dropped)
 {
-	struct le *le;
+	const size_t fsz = ab->ch * 2;
+	const int32_t jump = (int32_t)((ab->max_sz ? ab->max_sz :
+					8 * ab->wish_sz) / fsz);
+	uint32_t tail;
+	struct le *le, *next;
 
-	if (!ab || !p || !sz)
-		return;
+	if (!ab->ts_on)
+		ts_start(ab, af->ts);
 
-	lock_write_get(ab->lock);
+	tail = ts_tail(ab);
 
-	if (ab->cur_sz < (ab->filling ? ab->wish_sz : sz)) {
-#if AUBUF_DEBUG
-		if (!ab->filling) {
-			++ab->stats.ur;
-			(void)re_printf("aubuf: %p underrun (cur=%zu)\n",
-					ab, ab->cur_sz);
-		}
-#endif
-		ab->filling = true;
-		memset(p, 0, sz);
-		goto out;
-	}
+	/* a new stream, or a timestamp jump */
+	if (ts_diff(af->ts, tail) > jump ||
+	    ts_diff(af->ts, ab->ts_rd) < -jump) {
 
-	ab->filling = false;
+		*dropped += ab->cur_sz;
 
-	le = ab->afl.head;
+		list_flush(&ab->afl);
+		ab->cur_sz = 0;
+		ab->ts_rd  = af->ts;
+		tail       = af->ts;
+	}
 
-	while (le) {
-		struct auframe *af = le->data;
-		size_t n;
+	if (ts_diff(af->ts, ab->ts_rd) < 0)
+		return false;
 
-		le = le->next;
+	for (le=ab->afl.tail; le; le=le->prev) {
 
-		n = min(mbuf_get_left(af->mb), sz);
+		const struct auframe *prev = le->data;
 
-		(void)mbuf_read_mem(af->mb, p, n);
-		ab->cur_sz -= n;
+		if (ts_diff(prev->ts_end, af->ts) <= 0)
+			break;
+	}
 
-		if (!mbuf_get_left(af->mb))
-			mem_deref(af);
+	next = le ? le->next : ab->afl.head;
 
-		if (n == sz)
-			break;
+	if (next && ts_diff(af->ts_end,
+			    ((struct auframe *)next->data)->ts) > 0)
+		return false;
 
-		p  += n;
-		sz -= n;
-	}
+	if (le)
+		list_insert_after(&ab->afl, le, &af->le, af);
+	else
+		list_prepend(&ab->afl, &af->le, af);
 
- out:
-	lock_rel(ab->lock);
+	if (ts_diff(af->ts_end, tail) > 0)
+		ab->cur_sz += (size_t)ts_diff(af->ts_end, tail) * fsz;
+
+	return true;
 }
 
 
-/**
- * Timed read PCM samples from the audio buffer. If there is not enough data
- * in the audio buffer, silence will be read.
- *
- * @param ab    Audio buffer
- * @param ptime Packet time in [ms]
- * @param p     Buffer where PCM samples are read into
- * @param sz    Number of bytes to read
- *
- * @note This does the same as aubuf_read() except that it also takes
- *       timing into consideration.
- *
- * @return 0 if valid PCM was read, ETIMEDOUT if no PCM is ready yet
+/*
+ * Append a frame to the list. The statistics are updated after the lock
+ * is released, so that readers of the statistics do not contend with
+ * the writer inside the critical section.
  */
-int aubuf_get(struct aubuf *ab, uint32_t ptime, uint8_t *p, size_t sz)
+static int frame_append(struct aubuf *ab, struct mbuf *mb, bool has_ts,
+			uint32_t ts)
 {
-	uint64_t now;
-	int err = 0;
+	const size_t sz = mbuf_get_left(mb);
+	struct auframe *af;
+	size_t dropped = 0;
+	uint32_t overrun = 0, late = 0;
 
-	if (!ab || !ptime)
-		return EINVAL;
+	af = mem_zalloc(sizeof(*af), auframe_destructor);
+	if (!af)
+		return ENOMEM;
+
+	af->mb = mem_ref(mb);
 
 	lock_write_get(ab->lock);
 
-	now = tmr_jiffies();
-	if (!ab->ts)
-		ab->ts = now;
+	if (ab->mode == AUBUF_ADAPTIVE)
+		jitter_update(ab, sz);
 
-	if (now < ab->ts) {
-		err = ETIMEDOUT;
-		goto out;
+	if (has_ts || ab->ts_on) {
+
+		af->ts     = has_ts ? ts : ts_tail(ab);
+		af->ts_end = af->ts + (uint32_t)(sz / (ab->ch * 2));
+
+		if (!ts_insert(ab, af, &dropped)) {
+			late     = 1;
+			dropped += sz;
+			mem_deref(af);
+			goto out;
+		}
+	}
+	else {
+		list_append(&ab->afl, &af->le, af);
+		ab->cur_sz += sz;
 	}
 
-	ab->ts += ptime;
+	/* in adaptive mode, the reader trims the buffer to max_sz */
+	if (ab->max_sz && ab->cur_sz > (ab->mode == AUBUF_ADAPTIVE ?
+					2 * ab->max_sz : ab->max_sz)) {
+		size_t n;
+#if AUBUF_DEBUG
+		(void)re_printf("aubuf: %p overrun (cur=%zu)\n",
+				ab, ab->cur_sz);
+#endif
+		overrun = 1;
+
+		af = list_ledata(ab->afl.head);
+		if (af) {
+			if (ab->ts_on) {
+				n = (size_t)ts_diff(af->ts_end, ab->ts_rd) *
+					ab->ch * 2;
+				ab->ts_rd = af->ts_end;
+			}
+			else {
+				n = mbuf_get_left(af->mb);
+			}
+
+			dropped    += n;
+			ab->cur_sz -= n;
+			mem_deref(af);
+		}
+	}
 
  out:
 	lock_rel(ab->lock);
 
-	if (!err)
-		aubuf_read(ab, p, sz);
+	AUBUF_ADD(&ab->stats.bytes_in, sz);
 
-	return err;
+	if (dropped)
+		AUBUF_ADD(&ab->stats.dropped, dropped);
+	if (overrun)
+		AUBUF_ADD(&ab->stats.overrun, overrun);
+	if (late)
+		AUBUF_ADD(&ab->stats.late, late);
+
+	return 0;
 }
 
 
 /**
- * Flush the audio buffer
+ * Append a PCM-buffer to the end of the audio buffer
  *
  * @param ab Audio buffer
+ * @param mb Mbuffer with PCM samples
+ *
+ * @return 0 for success, otherwise error code
  */
-void aubuf_flush(struct aubuf *ab)
+int aubuf_append(struct aubuf *ab, struct mbuf *mb)
 {
-	if (!ab)
-		return;
+	if (!ab || !mb)
+		return EINVAL;
 
-	lock_write_get(ab->lock);
+	if (ab->ring)
+		return aubuf_write(ab, mbuf_buf(mb), mbuf_get_left(mb));
 
-	list_flush(&ab->afl);
-	ab->filling = true;
-	ab->cur_sz  = 0;
-	ab->ts      = 0;
+	return frame_append(ab, mb, false, 0);
+}
 
-	lock_rel(ab->lock);
+
+/**
+ * Insert a PCM-buffer in timestamp order, for out-of-order packets
+ *
+ * Frames that are late, or that overlap buffered frames, are dropped.
+ * Missing frames are concealed when read, see aubuf_set_plc(). The
+ * reads must be a whole number of samples of all channels.
+ *
+ * @param ab Audio buffer
+ * @param mb Mbuffer with PCM samples
+ * @param ts Timestamp of the first sample, in samples per channel
+ *
+ * @return 0 for success, otherwise error code
+ *
+ * @note Needs the audio format, see aubuf_set_format(), and is not
+ *       supported in ring mode
+ */
+int aubuf_append_ts(struct aubuf *ab, struct mbuf *mb, uint32_t ts)
+{
+	if (!ab || !mb || !ab->ch)
+		return EINVAL;
+
+	if (ab->ring)
+		return ENOTSUP;
+
+	return frame_append(ab, mb, true, ts);
 }
 
 
 /**
- * Audio buffer debug handler, use with fmt %H
+ * Write PCM samples to the audio buffer
  *
- * @param pf Print function
  * @param ab Audio buffer
+ * @param p  Pointer to PCM data
+ * @param sz Number of bytes to write
  *
- * @return 0 if success, otherwise errorcode
+ * @return 0 for success, otherwise error code
  */
-int aubuf_debug(struct re_printf *pf, const struct aubuf *ab)
+int aubuf_write(struct aubuf *ab, const uint8_t *p, size_t sz)
 {
+	struct mbuf *mb;
 	int err;
 
-	if (!ab)
-		return 0;
+	if (ab && ab->ring) {
 
-	lock_read_get(ab->lock);
-	err = re_hprintf(pf, "wish_sz=%zu cur_sz=%zu filling=%d",
-			 ab->wish_sz, ab->cur_sz, ab->filling);
+		if (!p)
+			return EINVAL;
+
+		if (AUBUF_LOAD(&ab->mode) == AUBUF_ADAPTIVE)
+			jitter_update(ab, sz);
 
+		AUBUF_ADD(&ab->stats.bytes_in, sz);
+
+		if (!aubuf_ring_write(ab->ring, p, sz)) {
 #if AUBUF_DEBUG
-	err |= re_hprintf(pf, " [overrun=%zu underrun=%zu]",
-			  ab->stats.or, ab->stats.ur);
+			(void)re_printf("aubuf: %p ring full\n", ab);
 #endif
+			AUBUF_ADD(&ab->stats.overrun, 1);
+			AUBUF_ADD(&ab->stats.dropped, sz);
+		}
 
-	lock_rel(ab->lock);
+		return 0;
+	}
+
+	mb = mbuf_alloc(sz);
+	if (!mb)
+		return ENOMEM;
+
+	(void)mbuf_write_mem(mb, p, sz);
+	mb->pos = 0;
+
+	err = aubuf_append(ab, mb);
+
+	mem_deref(mb);
 
 	return err;
 }
 
 
 /**
- * Get the current number of bytes in the audio buffer
+ * Write PCM samples to the audio buffer, in timestamp order
  *
  * @param ab Audio buffer
+ * @param p  Pointer to PCM data
+ * @param sz Number of bytes to write
+ * @param ts Timestamp of the first sample, in samples per channel
  *
- * @return Number of bytes in the audio buffer
+ * @return 0 for success, otherwise error code
+ *
+ * @note See aubuf_append_ts()
  */
-size_t aubuf_cur_size(const struct aubuf *ab)
+int aubuf_write_ts(struct aubuf *ab, const uint8_t *p, size_t sz,
+		   uint32_t ts)
 {
-	size_t sz;
+	struct mbuf *mb;
+	int err;
 
-	if (!ab)
-		return 0;
+	if (!ab || !p)
+		return EINVAL;
+
+	if (ab->ring)
+		return ENOTSUP;
+
+	mb = mbuf_alloc(sz);
+	if (!mb)
+		return ENOMEM;
+
+	(void)mbuf_write_mem(mb, p, sz);
+	mb->pos = 0;
+
+	err = aubuf_append_ts(ab, mb, ts);
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/* Update the fill level statistics at each read, reader only */
+static void stat_fill(struct aubuf *ab, size_t cur_sz)
+{
+	const size_t bin = min(cur_sz / ab->hist_step,
+			       (size_t)AUBUF_HIST_BINS - 1);
+
+	AUBUF_STORE(&ab->stats.reads, ab->stats.reads + 1);
+	AUBUF_STORE(&ab->stats.fill_sum, ab->stats.fill_sum + cur_sz);
+	AUBUF_STORE(&ab->stats.histv[bin], ab->stats.histv[bin] + 1);
+
+	if (cur_sz < ab->stats.fill_min)
+		AUBUF_STORE(&ab->stats.fill_min, cur_sz);
+	if (cur_sz > ab->stats.fill_max)
+		AUBUF_STORE(&ab->stats.fill_max, cur_sz);
+}
+
+
+/*
+ * Check the fill level before a read, and update the statistics
+ *
+ * Returns false on underrun, and while filling up to wish_sz. A read
+ * larger than wish_sz also waits for the whole read, so that no more
+ * is read than is stored.
+ */
+static bool read_ready(struct aubuf *ab, size_t cur_sz, size_t wish_sz,
+		       size_t sz)
+{
+	stat_fill(ab, cur_sz);
+
+	if (cur_sz < (ab->filling ? max(wish_sz, sz) : sz)) {
+		if (!ab->filling) {
+#if AUBUF_DEBUG
+			(void)re_printf("aubuf: %p underrun (cur=%zu)\n",
+					ab, cur_sz);
+#endif
+			AUBUF_ADD(&ab->stats.underrun, 1);
+		}
+		ab->filling = true;
+		return false;
+	}
+
+	ab->filling = false;
+
+	return true;
+}
+
+
+/* Check if the packet loss concealment can handle a read */
+static inline bool plc_enabled(const struct aubuf *ab, const uint8_t *p,
+			       size_t sz)
+{
+	return AUBUF_LOAD(&ab->plc_on) && ab->plc &&
+		!(sz % (ab->ch * 2)) && !((uintptr_t)p & 1);
+}
+
+
+/* Conceal the lost audio on underrun, or read silence */
+static void read_lost(struct aubuf *ab, uint8_t *p, size_t sz)
+{
+	if (plc_enabled(ab, p, sz))
+		aubuf_plc_conceal(ab->plc, (int16_t *)(void *)p, sz / 2);
+	else
+		memset(p, 0, sz);
+}
+
+
+/* Let the packet loss concealment see the audio that is read */
+static void read_good(struct aubuf *ab, uint8_t *p, size_t sz)
+{
+	if (plc_enabled(ab, p, sz))
+		aubuf_plc_good(ab->plc, (int16_t *)(void *)p, sz / 2);
+}
+
+
+/* Apply a pending flush request in ring mode, reader only */
+static void ring_flushed(struct aubuf *ab)
+{
+	if (!aubuf_ring_flushed(ab->ring))
+		return;
+
+	ab->filling = true;
+	ab->ts      = 0;
+	AUBUF_STORE(&ab->res_sz, 0);
+	aubuf_plc_reset(ab->plc);
+}
+
+
+/*
+ * Apply flush and overrun before a read in ring mode, reader only
+ *
+ * An overrun drops whole frames, or whole samples if the format is not
+ * set, so that the channels stay in order.
+ */
+static size_t ring_trim(struct aubuf *ab)
+{
+	const size_t fsz = ab->ch ? ab->ch * 2 : 2;
+	size_t cur_sz, n;
+
+	ring_flushed(ab);
+
+	cur_sz = aubuf_ring_used(ab->ring);
+
+	if (cur_sz > ab->max_sz) {
+#if AUBUF_DEBUG
+		(void)re_printf("aubuf: %p overrun (cur=%zu)\n",
+				ab, cur_sz);
+#endif
+		n = cur_sz - ab->max_sz;
+		n += (fsz - n % fsz) % fsz;
+		n  = min(n, cur_sz);
+
+		AUBUF_ADD(&ab->stats.overrun, 1);
+		AUBUF_ADD(&ab->stats.dropped, n);
+
+		aubuf_ring_skip(ab->ring, n);
+		cur_sz -= n;
+	}
+
+	return cur_sz;
+}
+
+
+static void ring_read(struct aubuf *ab, uint8_t *p, size_t sz)
+{
+	if (!read_ready(ab, ring_trim(ab), ab->wish_sz, sz)) {
+		read_lost(ab, p, sz);
+		return;
+	}
+
+	aubuf_ring_read(ab->ring, p, sz);
+	read_good(ab, p, sz);
+
+	AUBUF_ADD(&ab->stats.bytes_out, sz);
+}
+
+
+/*
+ * Read from the frame list, or skip if p is NULL
+ *
+ * Gaps in the timestamp order are concealed, or read as silence. With
+ * plc, the concealment also sees the audio that is read.
+ */
+static void list_read(struct aubuf *ab, uint8_t *p, size_t sz, bool plc)
+{
+	const size_t fsz = ab->ch * 2;
+	struct le *le = ab->afl.head;
+
+	while (le && sz) {
+		struct auframe *af = le->data;
+		size_t n;
+
+		if (ab->ts_on && ts_diff(af->ts, ab->ts_rd) > 0) {
+
+			n = min((size_t)ts_diff(af->ts, ab->ts_rd) * fsz, sz);
+
+			if (p && plc)
+				read_lost(ab, p, n);
+			else if (p)
+				memset(p, 0, n);
+
+			if (p)
+				p += n;
+
+			ab->ts_rd  += (uint32_t)(n / fsz);
+			ab->cur_sz -= n;
+			sz         -= n;
+			continue;
+		}
+
+		le = le->next;
+
+		n = min(mbuf_get_left(af->mb), sz);
+
+		if (p) {
+			(void)mbuf_read_mem(af->mb, p, n);
+
+			if (plc)
+				read_good(ab, p, n);
+
+			p += n;
+		}
+		else {
+			mbuf_advance(af->mb, n);
+		}
+
+		if (ab->ts_on)
+			ab->ts_rd += (uint32_t)(n / fsz);
+
+		ab->cur_sz -= n;
+
+		if (!mbuf_get_left(af->mb))
+			mem_deref(af);
+
+		sz -= n;
+	}
+}
+
+
+/*
+ * The list and the ring, as seen by the reader in adaptive mode
+ */
+
+static size_t backend_size(const struct aubuf *ab)
+{
+	return ab->ring ? aubuf_ring_used(ab->ring) : ab->cur_sz;
+}
+
+
+static void backend_read(struct aubuf *ab, uint8_t *p, size_t sz)
+{
+	if (!ab->ring)
+		list_read(ab, p, sz, false);
+	else if (p)
+		aubuf_ring_read(ab->ring, p, sz);
+	else
+		aubuf_ring_skip(ab->ring, sz);
+}
+
+
+/* Drop the oldest bytes, from the stretched samples first */
+static void jb_drop(struct aubuf *ab, size_t sz)
+{
+	const size_t n = min(sz, ab->res_sz);
+
+	memmove(ab->resv, (uint8_t *)ab->resv + n, ab->res_sz - n);
+	AUBUF_STORE(&ab->res_sz, ab->res_sz - n);
+
+	backend_read(ab, NULL, sz - n);
+}
+
+
+/*
+ * Shorten or lengthen the next read by one pitch period
+ *
+ * The stretched samples are kept for the next reads. If there are more
+ * of them than the stretch needs, e.g. after an expand and a short read,
+ * they are stretched again without reading more. Returns false if the
+ * signal can not be stretched.
+ */
+static bool jb_stretch(struct aubuf *ab, size_t sz, bool accel)
+{
+	const size_t fsz  = ab->ch * 2;
+	const size_t tmax = ab->srate * AUBUF_PITCH_MAX / 1000;
+	const size_t len  = max(sz / fsz + 2 * tmax, ab->res_sz / fsz);
+	size_t t, n;
+
+	if (backend_size(ab) + ab->res_sz < len * fsz)
+		return false;
+
+	n = (len + tmax) * ab->ch;
+	if (ab->resn < n) {
+
+		int16_t *resv = mem_realloc(ab->resv, n * 2);
+		if (!resv)
+			return false;
+
+		ab->resv = resv;
+		ab->resn = n;
+	}
+
+	if (len * fsz > ab->res_sz)
+		backend_read(ab, (uint8_t *)ab->resv + ab->res_sz,
+			     len * fsz - ab->res_sz);
+
+	t = aubuf_pitch(ab->resv, ab->ch, ab->srate);
+	if (!t) {
+		AUBUF_STORE(&ab->res_sz, len * fsz);
+		return false;
+	}
+
+	if (accel) {
+		n = aubuf_accelerate(ab->resv, len, t, ab->ch);
+		AUBUF_STORE(&ab->jbstat.accel, ab->jbstat.accel + 1);
+		AUBUF_STORE(&ab->jbstat.accelc, ab->jbstat.accelc + t);
+	}
+	else {
+		n = aubuf_expand(ab->resv, len, t, ab->ch);
+		AUBUF_STORE(&ab->jbstat.expand, ab->jbstat.expand + 1);
+		AUBUF_STORE(&ab->jbstat.expandc, ab->jbstat.expandc + t);
+	}
+
+	AUBUF_STORE(&ab->res_sz, n * fsz);
+
+	return true;
+}
+
+
+/*
+ * Read in adaptive mode
+ *
+ * The fill level moves towards the target of the jitter estimate, by
+ * time-stretching instead of dropping or inserting audio. Also drains
+ * the stretched samples, after a switch back to the fixed mode.
+ */
+static void jb_read(struct aubuf *ab, uint8_t *p, size_t sz)
+{
+	const bool adaptive = AUBUF_LOAD(&ab->mode) == AUBUF_ADAPTIVE;
+	const size_t target = adaptive ? AUBUF_LOAD(&ab->jb.target) : 0;
+	const size_t fsz = ab->ch * 2;
+	size_t cur_sz, n;
+
+	if (ab->ring)
+		ring_flushed(ab);
+
+	cur_sz = backend_size(ab) + ab->res_sz;
+
+	if (ab->max_sz && cur_sz > ab->max_sz) {
+#if AUBUF_DEBUG
+		(void)re_printf("aubuf: %p overrun (cur=%zu)\n",
+				ab, cur_sz);
+#endif
+		n = cur_sz - ab->max_sz;
+		n += (fsz - n % fsz) % fsz;
+
+		AUBUF_ADD(&ab->stats.overrun, 1);
+		AUBUF_ADD(&ab->stats.dropped, n);
+
+		jb_drop(ab, n);
+		cur_sz -= n;
+	}
+
+	if (!read_ready(ab, cur_sz, max(target, ab->wish_sz), sz)) {
+		read_lost(ab, p, sz);
+		goto out;
+	}
+
+	if (adaptive && !(sz % fsz)) {
+
+		if (cur_sz > target + sz)
+			(void)jb_stretch(ab, sz, true);
+		else if (cur_sz + sz / 2 < target)
+			(void)jb_stretch(ab, sz, false);
+	}
+
+	n = min(sz, ab->res_sz);
+
+	memcpy(p, ab->resv, n);
+	jb_drop(ab, n);
+
+	backend_read(ab, p + n, sz - n);
+	read_good(ab, p, sz);
+
+	AUBUF_ADD(&ab->stats.bytes_out, sz);
+
+ out:
+	AUBUF_STORE(&ab->jbstat.delay, backend_size(ab) + ab->res_sz);
+}
+
+
+/**
+ * Read PCM samples from the audio buffer. If there is not enough data
+ * in the audio buffer, silence will be read.
+ *
+ * @param ab Audio buffer
+ * @param p  Buffer where PCM samples are read into
+ * @param sz Number of bytes to read
+ */
+void aubuf_read(struct aubuf *ab, uint8_t *p, size_t sz)
+{
+	bool good = false;
+
+	if (!ab || !p || !sz)
+		return;
+
+	if (ab->ring) {
+		if (AUBUF_LOAD(&ab->mode) == AUBUF_ADAPTIVE || ab->res_sz)
+			jb_read(ab, p, sz);
+		else
+			ring_read(ab, p, sz);
+		return;
+	}
+
+	lock_write_get(ab->lock);
+
+	if (ab->mode == AUBUF_ADAPTIVE || ab->res_sz) {
+		jb_read(ab, p, sz);
+		goto out;
+	}
+
+	if (!read_ready(ab, ab->cur_sz, ab->wish_sz, sz)) {
+		read_lost(ab, p, sz);
+		goto out;
+	}
+
+	list_read(ab, p, sz, true);
+	good = true;
+
+ out:
+	lock_rel(ab->lock);
+
+	if (good)
+		AUBUF_ADD(&ab->stats.bytes_out, sz);
+}
+
+
+/*
+ * Estimate the clock drift from the long-term fill level, reader only
+ *
+ * The fill level is averaged over DRIFT_AVG reads. Its trend over each
+ * window of DRIFT_WIN reads is added to the drift estimate, and its
+ * distance from the level at the start is corrected slowly, so that the
+ * latency stays constant.
+ *
+ * Returns 1 if one frame should be removed from this read, -1 if one
+ * frame should be inserted, otherwise 0.
+ */
+static int drift_update(struct aubuf *ab, size_t fill, size_t sz)
+{
+	const int64_t fsz = ab->ch * 2;
+	const int64_t lvl = (int64_t)fill << 8;
+
+	if (ab->filling) {
+		ab->drift.n = 0;
+		return 0;
+	}
+
+	if (!ab->drift.n)
+		ab->drift.avg = lvl;
+
+	ab->drift.avg += (lvl - ab->drift.avg) / DRIFT_AVG;
+
+	if (++ab->drift.n == DRIFT_WIN) {
+		ab->drift.ref  = ab->drift.avg;
+		ab->drift.last = ab->drift.avg;
+	}
+	else if (ab->drift.n > DRIFT_WIN && !(ab->drift.n % DRIFT_WIN)) {
+
+		/* bytes Q8 per window, to frames Q16 per read */
+		ab->drift.rate += (ab->drift.avg - ab->drift.last) * 256 /
+			(fsz * DRIFT_WIN * 2);
+		ab->drift.last  = ab->drift.avg;
+
+		AUBUF_STORE(&ab->stats.drift, (int32_t)(ab->drift.rate *
+			    1000000 / ((int64_t)sz / fsz * DRIFT_ONE)));
+	}
+
+	ab->drift.acc += ab->drift.rate;
+
+	if (ab->drift.n > DRIFT_WIN)
+		ab->drift.acc += (ab->drift.avg - ab->drift.ref) * 256 /
+			(fsz * DRIFT_WIN * 4);
+
+	if (ab->drift.acc >= DRIFT_ONE) {
+		ab->drift.acc -= DRIFT_ONE;
+		return 1;
+	}
+
+	if (ab->drift.acc <= -DRIFT_ONE) {
+		ab->drift.acc += DRIFT_ONE;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Read one frame more or less, and remove or insert one frame, n >= 3 */
+static void drift_read(struct aubuf *ab, uint8_t *p, size_t sz, int adj)
+{
+	const size_t n = sz / (ab->ch * 2);
+	const size_t m = adj > 0 ? n + 1 : n - 1;
+
+	if (ab->drift.tmpn < (n + 1) * ab->ch) {
+
+		int16_t *tmpv = mem_realloc(ab->drift.tmpv,
+					    (n + 1) * ab->ch * 2);
+		if (!tmpv) {
+			aubuf_read(ab, p, sz);
+			return;
+		}
+
+		ab->drift.tmpv = tmpv;
+		ab->drift.tmpn = (n + 1) * ab->ch;
+	}
+
+	aubuf_read(ab, (uint8_t *)ab->drift.tmpv, m * ab->ch * 2);
+
+	if (adj > 0) {
+		aubuf_sample_drop((int16_t *)(void *)p, ab->drift.tmpv, m,
+				  ab->ch);
+		AUBUF_ADD(&ab->stats.drift_rem, 1);
+	}
+	else {
+		aubuf_sample_insert((int16_t *)(void *)p, ab->drift.tmpv, m,
+				    ab->ch);
+		AUBUF_ADD(&ab->stats.drift_ins, 1);
+	}
+}
+
+
+/**
+ * Timed read PCM samples from the audio buffer. If there is not enough data
+ * in the audio buffer, silence will be read.
+ *
+ * @param ab    Audio buffer
+ * @param ptime Packet time in [ms]
+ * @param p     Buffer where PCM samples are read into
+ * @param sz    Number of bytes to read
+ *
+ * @note This does the same as aubuf_read() except that it also takes
+ *       timing into consideration.
+ *
+ * @return 0 if valid PCM was read, ETIMEDOUT if no PCM is ready yet
+ */
+int aubuf_get(struct aubuf *ab, uint32_t ptime, uint8_t *p, size_t sz)
+{
+	uint64_t now;
+	int adj = 0;
+	int err = 0;
+
+	if (!ab || !ptime)
+		return EINVAL;
+
+	/* in ring mode, the timing state is owned by the reader */
+	if (!ab->ring)
+		lock_write_get(ab->lock);
+
+	if (ab->ring)
+		ring_flushed(ab);
+
+	now = tmr_jiffies();
+	if (!ab->ts)
+		ab->ts = now;
+
+	if (now < ab->ts) {
+		err = ETIMEDOUT;
+		goto out;
+	}
+
+	ab->ts += ptime;
+
+	if (AUBUF_LOAD(&ab->drift.on) &&
+	    AUBUF_LOAD(&ab->mode) != AUBUF_ADAPTIVE &&
+	    p && sz >= 6 * ab->ch && !(sz % (ab->ch * 2)) &&
+	    !((uintptr_t)p & 1)) {
+
+		adj = drift_update(ab, backend_size(ab) + ab->res_sz, sz);
+	}
+
+ out:
+	if (!ab->ring)
+		lock_rel(ab->lock);
+
+	if (err)
+		return err;
+
+	if (adj)
+		drift_read(ab, p, sz, adj);
+	else
+		aubuf_read(ab, p, sz);
+
+	return 0;
+}
+
+
+/*
+ * Get up to two frames from the list as spans, with the lock held
+ *
+ * In timestamp order, each frame must follow the read position or the
+ * frame before it without a gap.
+ */
+static int list_peek(struct aubuf *ab, size_t sz, struct aubuf_span *spanv)
+{
+	struct le *le = ab->afl.head;
+	uint32_t ts = ab->ts_rd;
+	unsigned i;
+
+	ab->peekv[0] = mem_deref(ab->peekv[0]);
+	ab->peekv[1] = mem_deref(ab->peekv[1]);
+
+	for (i=0; i<2 && sz; i++) {
+
+		struct auframe *af = list_ledata(le);
+
+		if (!af)
+			break;
+
+		if (ab->ts_on && ts_diff(af->ts, ts) > 0)
+			return ERANGE;
+
+		spanv[i].p  = mbuf_buf(af->mb);
+		spanv[i].sz = min(mbuf_get_left(af->mb), sz);
+		sz -= spanv[i].sz;
+
+		ab->peekv[i] = mem_ref(af->mb);
+
+		ts = af->ts_end;
+		le = le->next;
+	}
+
+	ab->peek_sz = spanv[0].sz;
+
+	return sz ? ERANGE : 0;
+}
+
+
+/**
+ * Get buffered PCM samples without copying them
+ *
+ * The samples are returned as one or two contiguous spans, which stay
+ * valid until aubuf_consume() is called. Only one thread may peek and
+ * consume at a time.
+ *
+ * @param ab    Audio buffer
+ * @param sz    Number of bytes to get
+ * @param spanv Returned spans, the second one can be empty
+ *
+ * @return 0 if success, ENODATA on underrun (the caller plays silence),
+ *         ERANGE if the samples are not in two spans, or ENOTSUP in
+ *         adaptive mode or with packet loss concealment. Use
+ *         aubuf_read() for the last two cases.
+ */
+int aubuf_peek(struct aubuf *ab, size_t sz, struct aubuf_span spanv[2])
+{
+	int err = 0;
+
+	if (!ab || !sz || !spanv)
+		return EINVAL;
+
+	memset(spanv, 0, 2 * sizeof(*spanv));
+
+	if (AUBUF_LOAD(&ab->mode) == AUBUF_ADAPTIVE ||
+	    AUBUF_LOAD(&ab->plc_on) || AUBUF_LOAD(&ab->res_sz))
+		return ENOTSUP;
+
+	if (ab->ring) {
+
+		if (!read_ready(ab, ring_trim(ab), ab->wish_sz, sz))
+			return ENODATA;
+
+		aubuf_ring_peek(ab->ring, sz, &spanv[0].p, &spanv[0].sz,
+				&spanv[1].p, &spanv[1].sz);
+		return 0;
+	}
+
+	lock_write_get(ab->lock);
+
+	if (!read_ready(ab, ab->cur_sz, ab->wish_sz, sz)) {
+		err = ENODATA;
+		goto out;
+	}
+
+	err = list_peek(ab, sz, spanv);
+
+ out:
+	lock_rel(ab->lock);
+
+	return err;
+}
+
+
+/**
+ * Remove PCM samples from the audio buffer, after aubuf_peek()
+ *
+ * @param ab Audio buffer
+ * @param sz Number of bytes to remove
+ */
+void aubuf_consume(struct aubuf *ab, size_t sz)
+{
+	if (!ab)
+		return;
+
+	if (ab->ring) {
+		sz = min(sz, aubuf_ring_used(ab->ring));
+		aubuf_ring_skip(ab->ring, sz);
+		AUBUF_ADD(&ab->stats.bytes_out, sz);
+		return;
+	}
+
+	lock_write_get(ab->lock);
+
+	/* an overrun may have dropped the first peeked frame, then only
+	   the rest of the second one is removed */
+	if (ab->peekv[0]) {
+
+		const struct auframe *af = list_ledata(ab->afl.head);
+		const struct mbuf *mb = af ? af->mb : NULL;
+
+		if (mb != ab->peekv[0])
+			sz = mb && mb == ab->peekv[1] && sz > ab->peek_sz ?
+				sz - ab->peek_sz : 0;
+	}
+
+	sz = min(sz, ab->cur_sz);
+	list_read(ab, NULL, sz, false);
+
+	ab->peekv[0] = mem_deref(ab->peekv[0]);
+	ab->peekv[1] = mem_deref(ab->peekv[1]);
+
+	lock_rel(ab->lock);
+
+	AUBUF_ADD(&ab->stats.bytes_out, sz);
+}
+
+
+/**
+ * Flush the audio buffer
+ *
+ * @param ab Audio buffer
+ */
+void aubuf_flush(struct aubuf *ab)
+{
+	if (!ab)
+		return;
+
+	if (ab->ring) {
+		aubuf_ring_flush(ab->ring);
+		return;
+	}
+
+	lock_write_get(ab->lock);
+
+	list_flush(&ab->afl);
+	ab->filling = true;
+	ab->cur_sz  = 0;
+	ab->ts      = 0;
+	ab->res_sz  = 0;
+	ab->ts_on   = false;
+	aubuf_plc_reset(ab->plc);
+
+	lock_rel(ab->lock);
+}
+
+
+/**
+ * Audio buffer debug handler, use with fmt %H
+ *
+ * @param pf Print function
+ * @param ab Audio buffer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aubuf_debug(struct re_printf *pf, const struct aubuf *ab)
+{
+	int err;
+
+	if (!ab)
+		return 0;
+
+	lock_read_get(ab->lock);
+	err = re_hprintf(pf, "wish_sz=%zu cur_sz=%zu filling=%d",
+			 ab->wish_sz,
+			 ab->ring ? aubuf_ring_used(ab->ring) : ab->cur_sz,
+			 ab->filling);
+
+	if (AUBUF_LOAD(&ab->mode) == AUBUF_ADAPTIVE) {
+		err |= re_hprintf(pf, " target=%zu res_sz=%zu"
+				  " accel=%u expand=%u",
+				  AUBUF_LOAD(&ab->jb.target),
+				  AUBUF_LOAD(&ab->res_sz),
+				  AUBUF_LOAD(&ab->jbstat.accel),
+				  AUBUF_LOAD(&ab->jbstat.expand));
+	}
+
+	err |= re_hprintf(pf, " [overrun=%u underrun=%u]",
+			  AUBUF_LOAD(&ab->stats.overrun),
+			  AUBUF_LOAD(&ab->stats.underrun));
+
+	lock_rel(ab->lock);
+
+	return err;
+}
+
+
+/**
+ * Get the current number of bytes in the audio buffer
+ *
+ * @param ab Audio buffer
+ *
+ * @return Number of bytes in the audio buffer
+ */
+size_t aubuf_cur_size(const struct aubuf *ab)
+{
+	size_t sz;
+
+	if (!ab)
+		return 0;
+
+	if (ab->ring)
+		return aubuf_ring_used(ab->ring) + AUBUF_LOAD(&ab->res_sz);
 
 	lock_read_get(ab->lock);
-	sz = ab->cur_sz;
+	sz = ab->cur_sz + ab->res_sz;
 	lock_rel(ab->lock);
 
 	return sz;
 }
+
+
+/**
+ * Set the audio format of the audio buffer, needed for the adaptive mode
+ *
+ * @param ab    Audio buffer
+ * @param srate Sample rate in [Hz]
+ * @param ch    Number of channels
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note Must be called before any audio is written
+ */
+int aubuf_set_format(struct aubuf *ab, uint32_t srate, uint8_t ch)
+{
+	if (!ab || !srate || !ch)
+		return EINVAL;
+
+	lock_write_get(ab->lock);
+	ab->srate = srate;
+	ab->ch    = ch;
+	lock_rel(ab->lock);
+
+	return 0;
+}
+
+
+/**
+ * Set the mode of the audio buffer
+ *
+ * In adaptive mode, the audio buffer estimates the arrival jitter from
+ * the timing of the writes, and moves its fill level to a target that
+ * covers the jitter, between the minimum size and 3/4 of the maximum
+ * size. The fill level is changed by time-stretching the S16 samples,
+ * one pitch period at a time.
+ *
+ * @param ab   Audio buffer
+ * @param mode Buffer mode
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note The adaptive mode needs the audio format, see aubuf_set_format(),
+ *       and a sample rate of at least 8000 Hz
+ */
+int aubuf_set_mode(struct aubuf *ab, enum aubuf_mode mode)
+{
+	if (!ab)
+		return EINVAL;
+
+	if (mode == AUBUF_ADAPTIVE && ab->srate < 8000)
+		return EINVAL;
+
+	lock_write_get(ab->lock);
+	AUBUF_STORE(&ab->jb.target, ab->wish_sz);
+	AUBUF_STORE(&ab->mode, mode);
+	lock_rel(ab->lock);
+
+	return 0;
+}
+
+
+/**
+ * Enable or disable packet loss concealment
+ *
+ * When enabled, an underrun does not read silence. Instead, the last
+ * pitch period that was read is repeated with a gradual attenuation,
+ * in the style of ITU-T G.711 Appendix I, and the repetition is
+ * cross-faded into the audio when it resumes. The audio must be S16.
+ *
+ * @param ab     Audio buffer
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note Needs the audio format, see aubuf_set_format(). In ring mode,
+ *       it must be enabled the first time before any audio is read.
+ */
+int aubuf_set_plc(struct aubuf *ab, bool enable)
+{
+	int err = 0;
+
+	if (!ab)
+		return EINVAL;
+
+	lock_write_get(ab->lock);
+
+	if (enable && !ab->plc)
+		err = aubuf_plc_alloc(&ab->plc, ab->srate, ab->ch);
+
+	if (!err)
+		AUBUF_STORE(&ab->plc_on, enable);
+
+	lock_rel(ab->lock);
+
+	return err;
+}
+
+
+/**
+ * Enable or disable clock drift compensation in aubuf_get()
+ *
+ * When the writer and the reader run on different clocks, the buffer
+ * slowly fills up or drains. The drift is estimated from the long-term
+ * fill level, and compensated by removing or inserting single samples
+ * at the quietest point of a read, so that the latency stays constant.
+ * The audio must be S16, and the reads at least three frames long.
+ *
+ * @param ab     Audio buffer
+ * @param enable True to enable, false to disable
+ *
+ * @return 0 if success, otherwise errorcode
+ *
+ * @note Needs the audio format, see aubuf_set_format(). Not used in
+ *       adaptive mode, which keeps its own fill level.
+ */
+int aubuf_set_drift(struct aubuf *ab, bool enable)
+{
+	if (!ab || !ab->ch)
+		return EINVAL;
+
+	AUBUF_STORE(&ab->drift.on, enable);
+
+	return 0;
+}
+
+
+/**
+ * Get the statistics of the adaptive mode
+ *
+ * @param ab Audio buffer
+ * @param st Returned statistics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aubuf_adaptive_stats(const struct aubuf *ab, struct aubuf_adaptive *st)
+{
+	uint64_t bps;
+
+	if (!ab || !st)
+		return EINVAL;
+
+	if (!ab->srate)
+		return ENOENT;
+
+	bps = aubuf_bps(ab);
+
+	st->delay     = (uint32_t)(AUBUF_LOAD(&ab->jbstat.delay) * 1000 / bps);
+	st->target    = (uint32_t)(AUBUF_LOAD(&ab->jb.target) * 1000 / bps);
+	st->jitter    = AUBUF_LOAD(&ab->jb.jit_ms);
+	st->accel     = AUBUF_LOAD(&ab->jbstat.accel);
+	st->expand    = AUBUF_LOAD(&ab->jbstat.expand);
+	st->accel_ms  = (uint32_t)((uint64_t)AUBUF_LOAD(&ab->jbstat.accelc) *
+				   1000 / ab->srate);
+	st->expand_ms = (uint32_t)((uint64_t)AUBUF_LOAD(&ab->jbstat.expandc) *
+				   1000 / ab->srate);
+
+	return 0;
+}
+
+
+/**
+ * Get the statistics of the audio buffer
+ *
+ * The statistics are always on, and can be read from any thread while
+ * the audio buffer is in use. The fill level is sampled at each read.
+ *
+ * @param ab Audio buffer
+ * @param st Returned statistics
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aubuf_stats(const struct aubuf *ab, struct aubuf_stats *st)
+{
+	uint64_t reads;
+	unsigned i;
+
+	if (!ab || !st)
+		return EINVAL;
+
+	reads = AUBUF_LOAD(&ab->stats.reads);
+
+	st->bytes_in  = AUBUF_LOAD(&ab->stats.bytes_in);
+	st->bytes_out = AUBUF_LOAD(&ab->stats.bytes_out);
+	st->dropped   = AUBUF_LOAD(&ab->stats.dropped);
+	st->overrun   = AUBUF_LOAD(&ab->stats.overrun);
+	st->underrun  = AUBUF_LOAD(&ab->stats.underrun);
+	st->late      = AUBUF_LOAD(&ab->stats.late);
+	st->drift     = AUBUF_LOAD(&ab->stats.drift);
+	st->drift_ins = AUBUF_LOAD(&ab->stats.drift_ins);
+	st->drift_rem = AUBUF_LOAD(&ab->stats.drift_rem);
+	st->fill_min  = reads ? AUBUF_LOAD(&ab->stats.fill_min) : 0;
+	st->fill_max  = AUBUF_LOAD(&ab->stats.fill_max);
+	st->fill_avg  = reads ?
+		(size_t)(AUBUF_LOAD(&ab->stats.fill_sum) / reads) : 0;
+	st->hist_step = ab->hist_step;
+
+	for (i=0; i<AUBUF_HIST_BINS; i++)
+		st->histv[i] = AUBUF_LOAD(&ab->stats.histv[i]);
+
+	return 0;
+}
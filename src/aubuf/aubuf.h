@@ -0,0 +1,70 @@
+/**
+ * @file aubuf/aubuf.h  Audio Buffer -- internal API
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/*
+ * Single-producer/single-consumer ring buffer
+ *
+ * One thread writes, and one thread reads. The ring can be flushed and
+ * its size read from any thread.
+ */
+
+struct aubuf_ring;
+
+int    aubuf_ring_alloc(struct aubuf_ring **ringp, size_t size);
+bool   aubuf_ring_write(struct aubuf_ring *ring, const uint8_t *p,
+			size_t sz);
+void   aubuf_ring_read(struct aubuf_ring *ring, uint8_t *p, size_t sz);
+void   aubuf_ring_peek(const struct aubuf_ring *ring, size_t sz,
+		       const uint8_t **p1, size_t *n1,
+		       const uint8_t **p2, size_t *n2);
+void   aubuf_ring_skip(struct aubuf_ring *ring, size_t sz);
+size_t aubuf_ring_used(const struct aubuf_ring *ring);
+void   aubuf_ring_flush(struct aubuf_ring *ring);
+bool   aubuf_ring_flushed(struct aubuf_ring *ring);
+
+
+/*
+ * Time-scale modification
+ */
+
+/** Longest pitch period in [ms], the search needs twice as many samples */
+#define AUBUF_PITCH_MAX  15
+
+size_t aubuf_pitch(const int16_t *sampv, unsigned ch, uint32_t srate);
+size_t aubuf_accelerate(int16_t *sampv, size_t len, size_t t, unsigned ch);
+size_t aubuf_expand(int16_t *sampv, size_t len, size_t t, unsigned ch);
+void   aubuf_sample_drop(int16_t *dst, const int16_t *src, size_t n,
+			 unsigned ch);
+void   aubuf_sample_insert(int16_t *dst, const int16_t *src, size_t n,
+			   unsigned ch);
+
+
+/*
+ * Packet loss concealment
+ */
+
+struct aubuf_plc;
+
+int  aubuf_plc_alloc(struct aubuf_plc **plcp, uint32_t srate, uint8_t ch);
+void aubuf_plc_reset(struct aubuf_plc *plc);
+void aubuf_plc_conceal(struct aubuf_plc *plc, int16_t *sampv, size_t sampc);
+void aubuf_plc_good(struct aubuf_plc *plc, int16_t *sampv, size_t sampc);
+
+
+/*
+ * Relaxed atomics, for state that is read by other threads
+ */
+
+#if defined (__GNUC__)
+#define AUBUF_LOAD(p)       __atomic_load_n((p), __ATOMIC_RELAXED)
+#define AUBUF_STORE(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define AUBUF_ADD(p, v)     __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#else
+#define AUBUF_LOAD(p)       (*(p))
+#define AUBUF_STORE(p, v)   (*(p) = (v))
+#define AUBUF_ADD(p, v)     (*(p) += (v))
+#endif
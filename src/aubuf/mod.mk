@@ -5,3 +5,6 @@
 #
 
 SRCS	+= aubuf/aubuf.c
+SRCS	+= aubuf/ring.c
+SRCS	+= aubuf/stretch.c
+SRCS	+= aubuf/plc.c
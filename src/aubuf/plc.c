@@ -0,0 +1,261 @@
+/**
+ * @file plc.c  Audio Buffer -- packet loss concealment
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include "aubuf.h"
+
+
+/*
+ * Pitch-repetition concealment, in the style of ITU-T G.711 Appendix I
+ *
+ * A lost frame is replaced by repeating the last pitch period that was
+ * played. After 10 ms, two periods are repeated, and after 20 ms three
+ * periods, to avoid a buzzy sound. After 10 ms the signal is attenuated
+ * by 20% per 10 ms, so that it is silent after 60 ms. When the audio
+ * resumes, the concealed signal is cross-faded into the real one.
+ */
+
+
+enum {
+	PLC_PERIOD_MS = 10,    /* Time until one more period is repeated */
+	PLC_ATT_MS    = 10,    /* Time until the attenuation starts      */
+	PLC_MAX_MS    = 60,    /* Time until silence                     */
+	PLC_FADE_MS   = 4,     /* Cross-fade at resume, minimum          */
+	PLC_FADE_MAX  = 10,    /* Cross-fade at resume, maximum          */
+};
+
+
+/** Defines the packet loss concealment state */
+struct aubuf_plc {
+	int16_t *histv;   /* last played samples, interleaved  */
+	size_t histc;     /* number of frames in the history   */
+	size_t histn;     /* size of the history, in frames    */
+	size_t tmax;      /* longest pitch period, in frames   */
+	uint32_t srate;
+	uint8_t ch;
+	size_t t;         /* pitch period, 0 if not concealing */
+	size_t pos;       /* frames since the loss started     */
+};
+
+
+static void destructor(void *arg)
+{
+	struct aubuf_plc *plc = arg;
+
+	mem_deref(plc->histv);
+}
+
+
+/**
+ * Allocate a packet loss concealment state
+ *
+ * @param plcp  Pointer to allocated state
+ * @param srate Sample rate in [Hz], at least 8000 Hz
+ * @param ch    Number of channels
+ *
+ * @return 0 for success, otherwise error code
+ */
+int aubuf_plc_alloc(struct aubuf_plc **plcp, uint32_t srate, uint8_t ch)
+{
+	struct aubuf_plc *plc;
+
+	if (!plcp || srate < 8000 || !ch)
+		return EINVAL;
+
+	plc = mem_zalloc(sizeof(*plc), destructor);
+	if (!plc)
+		return ENOMEM;
+
+	plc->srate = srate;
+	plc->ch    = ch;
+	plc->tmax  = srate * AUBUF_PITCH_MAX / 1000;
+
+	/* three periods for the repetition, plus one for the overlap */
+	plc->histn = 4 * plc->tmax;
+
+	plc->histv = mem_alloc(plc->histn * ch * 2, NULL);
+	if (!plc->histv) {
+		mem_deref(plc);
+		return ENOMEM;
+	}
+
+	*plcp = plc;
+
+	return 0;
+}
+
+
+/**
+ * Reset the packet loss concealment, the history is forgotten
+ *
+ * @param plc Packet loss concealment state
+ */
+void aubuf_plc_reset(struct aubuf_plc *plc)
+{
+	if (!plc)
+		return;
+
+	plc->histc = 0;
+	plc->t     = 0;
+}
+
+
+/*
+ * Get a sample from a loop over the last nper pitch periods of the
+ * history. The end of the loop is faded into the samples before its
+ * start, over a quarter period, so that the loop wraps smoothly.
+ */
+static int32_t loop_samp(const struct aubuf_plc *plc, size_t nper,
+			 size_t pos, unsigned c)
+{
+	const size_t len = nper * plc->t;
+	const size_t q   = max(plc->t / 4, (size_t)1);
+	const size_t s   = plc->histc - len;
+	const size_t i   = pos % len;
+	const uint8_t ch = plc->ch;
+	int32_t v, w;
+
+	v = plc->histv[(s + i) * ch + c];
+
+	if (i < len - q)
+		return v;
+
+	w = (int32_t)((i - (len - q) + 1) * 32768 / (q + 1));
+
+	return (v * (32768 - w) +
+		plc->histv[(s - q + i - (len - q)) * ch + c] * w) >> 15;
+}
+
+
+/* Get a concealed sample, at a position in the loss */
+static int16_t plc_samp(const struct aubuf_plc *plc, size_t pos, unsigned c)
+{
+	const size_t per = plc->srate * PLC_PERIOD_MS / 1000;
+	const size_t att = plc->srate * PLC_ATT_MS / 1000;
+	const size_t end = plc->srate * PLC_MAX_MS / 1000;
+	const size_t q   = max(plc->t / 4, (size_t)1);
+	const size_t nper = min(pos / per + 1, (size_t)3);
+	int32_t v, g;
+
+	if (pos >= end)
+		return 0;
+
+	v = loop_samp(plc, nper, pos, c);
+
+	/* more periods, faded in over a quarter period */
+	if (nper > 1 && pos - (nper - 1) * per < q) {
+
+		const int32_t w = (int32_t)((pos - (nper - 1) * per + 1) *
+					    32768 / (q + 1));
+
+		v = (loop_samp(plc, nper - 1, pos, c) * (32768 - w) +
+		     v * w) >> 15;
+	}
+
+	if (pos < att)
+		return (int16_t)v;
+
+	g = (int32_t)((end - pos) * 32768 / (end - att));
+
+	return (int16_t)((v * g) >> 15);
+}
+
+
+/**
+ * Conceal lost audio, following the last played audio
+ *
+ * @param plc   Packet loss concealment state
+ * @param sampv Buffer for the concealed samples
+ * @param sampc Number of samples, a multiple of the channel count
+ */
+void aubuf_plc_conceal(struct aubuf_plc *plc, int16_t *sampv, size_t sampc)
+{
+	const size_t n = sampc / plc->ch;
+	size_t i;
+	unsigned c;
+
+	/* not enough audio to repeat */
+	if (plc->histc < plc->histn) {
+		memset(sampv, 0, sampc * 2);
+		return;
+	}
+
+	if (!plc->t) {
+		const size_t k = plc->histc - 2 * plc->tmax;
+
+		plc->t = aubuf_pitch(&plc->histv[k * plc->ch], plc->ch,
+				     plc->srate);
+
+		/* not periodic, repeat the longest period */
+		if (!plc->t)
+			plc->t = plc->tmax;
+
+		plc->pos = 0;
+	}
+
+	for (i=0; i<n; i++) {
+		for (c=0; c<plc->ch; c++)
+			sampv[i * plc->ch + c] = plc_samp(plc, plc->pos, c);
+
+		++plc->pos;
+	}
+}
+
+
+/**
+ * Handle played audio, it is cross-faded from the concealed audio if
+ * there was a loss before
+ *
+ * @param plc   Packet loss concealment state
+ * @param sampv Played samples, modified in place
+ * @param sampc Number of samples, a multiple of the channel count
+ */
+void aubuf_plc_good(struct aubuf_plc *plc, int16_t *sampv, size_t sampc)
+{
+	const size_t n = sampc / plc->ch;
+	const uint8_t ch = plc->ch;
+	size_t i, k;
+	unsigned c;
+
+	if (plc->t) {
+
+		/* longer losses fade for longer */
+		const size_t ms = min(PLC_FADE_MS + plc->pos * 100 /
+				      plc->srate, (size_t)PLC_FADE_MAX);
+		const size_t fade = min(n, plc->srate * ms / 1000);
+
+		for (i=0; i<fade; i++) {
+
+			const int32_t w = (int32_t)((i + 1) * 32768 /
+						    (fade + 1));
+
+			for (c=0; c<ch; c++) {
+
+				int16_t *v = &sampv[i * ch + c];
+
+				*v = (int16_t)((plc_samp(plc, plc->pos + i, c)
+						* (32768 - w) + *v * w) >> 15);
+			}
+		}
+
+		plc->t = 0;
+	}
+
+	/* keep the last part of the played audio */
+	if (n >= plc->histn) {
+		memcpy(plc->histv, &sampv[(n - plc->histn) * ch],
+		       plc->histn * ch * 2);
+		plc->histc = plc->histn;
+		return;
+	}
+
+	k = min(plc->histc, plc->histn - n);
+
+	memmove(plc->histv, &plc->histv[(plc->histc - k) * ch], k * ch * 2);
+	memcpy(&plc->histv[k * ch], sampv, n * ch * 2);
+
+	plc->histc = k + n;
+}
@@ -0,0 +1,284 @@
+/**
+ * @file ring.c  Audio Buffer -- lock-free ring buffer
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include "aubuf.h"
+
+
+/*
+ * The read and write positions are free-running counters, and the ring
+ * size is a power of two, so that the counters can wrap around.
+ *
+ * Without compiler atomics, the positions are protected by a lock.
+ */
+#if !defined (__GNUC__)
+#define RING_LOCK 1
+#endif
+
+
+/** Defines a single-producer/single-consumer ring buffer */
+struct aubuf_ring {
+	uint8_t *buf;
+	size_t size;
+	size_t wpos;       /* written by the producer only  */
+	size_t rpos;       /* written by the consumer only  */
+	size_t flush_pos;  /* latest flush request position */
+	size_t flushed;    /* flush position seen, consumer */
+#ifdef RING_LOCK
+	struct lock *lock;
+#endif
+};
+
+
+static inline size_t pos_load(const struct aubuf_ring *ring, const size_t *p)
+{
+#ifdef RING_LOCK
+	size_t v;
+
+	lock_read_get(ring->lock);
+	v = *p;
+	lock_rel(ring->lock);
+
+	return v;
+#else
+	(void)ring;
+
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+
+static inline void pos_store(struct aubuf_ring *ring, size_t *p, size_t v)
+{
+#ifdef RING_LOCK
+	lock_write_get(ring->lock);
+	*p = v;
+	lock_rel(ring->lock);
+#else
+	(void)ring;
+
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+}
+
+
+static void destructor(void *arg)
+{
+	struct aubuf_ring *ring = arg;
+
+	mem_deref(ring->buf);
+#ifdef RING_LOCK
+	mem_deref(ring->lock);
+#endif
+}
+
+
+/**
+ * Allocate a new ring buffer
+ *
+ * @param ringp Pointer to allocated ring buffer
+ * @param size  Minimum size in bytes, rounded up to a power of two
+ *
+ * @return 0 for success, otherwise error code
+ */
+int aubuf_ring_alloc(struct aubuf_ring **ringp, size_t size)
+{
+	struct aubuf_ring *ring;
+	int err = 0;
+
+	if (!ringp || !size)
+		return EINVAL;
+
+	ring = mem_zalloc(sizeof(*ring), destructor);
+	if (!ring)
+		return ENOMEM;
+
+	ring->size = 1;
+	while (ring->size < size)
+		ring->size <<= 1;
+
+	ring->buf = mem_alloc(ring->size, NULL);
+	if (!ring->buf) {
+		err = ENOMEM;
+		goto out;
+	}
+
+#ifdef RING_LOCK
+	err = lock_alloc(&ring->lock);
+	if (err)
+		goto out;
+#endif
+
+ out:
+	if (err)
+		mem_deref(ring);
+	else
+		*ringp = ring;
+
+	return err;
+}
+
+
+/**
+ * Write to the ring buffer, producer only
+ *
+ * @param ring Ring buffer
+ * @param p    Data to write
+ * @param sz   Number of bytes to write
+ *
+ * @return True if written, false if there was not enough free space
+ */
+bool aubuf_ring_write(struct aubuf_ring *ring, const uint8_t *p, size_t sz)
+{
+	const size_t wpos = ring->wpos;
+	size_t i, n;
+
+	if (sz > ring->size - (wpos - pos_load(ring, &ring->rpos)))
+		return false;
+
+	i = wpos & (ring->size - 1);
+	n = min(sz, ring->size - i);
+
+	memcpy(&ring->buf[i], p, n);
+	memcpy(ring->buf, p + n, sz - n);
+
+	pos_store(ring, &ring->wpos, wpos + sz);
+
+	return true;
+}
+
+
+/**
+ * Read from the ring buffer, consumer only
+ *
+ * @param ring Ring buffer
+ * @param p    Buffer to read into
+ * @param sz   Number of bytes to read, at most aubuf_ring_used()
+ */
+void aubuf_ring_read(struct aubuf_ring *ring, uint8_t *p, size_t sz)
+{
+	const size_t rpos = ring->rpos;
+	size_t i, n;
+
+	i = rpos & (ring->size - 1);
+	n = min(sz, ring->size - i);
+
+	memcpy(p, &ring->buf[i], n);
+	memcpy(p + n, ring->buf, sz - n);
+
+	pos_store(ring, &ring->rpos, rpos + sz);
+}
+
+
+/**
+ * Get the data at the read position without reading it, consumer only
+ *
+ * @param ring Ring buffer
+ * @param sz   Number of bytes, at most aubuf_ring_used()
+ * @param p1   Returns the first part of the data
+ * @param n1   Returns the size of the first part
+ * @param p2   Returns the second part, after a wrap-around
+ * @param n2   Returns the size of the second part
+ */
+void aubuf_ring_peek(const struct aubuf_ring *ring, size_t sz,
+		     const uint8_t **p1, size_t *n1,
+		     const uint8_t **p2, size_t *n2)
+{
+	const size_t i = ring->rpos & (ring->size - 1);
+
+	*n1 = min(sz, ring->size - i);
+	*p1 = &ring->buf[i];
+	*n2 = sz - *n1;
+	*p2 = *n2 ? ring->buf : NULL;
+}
+
+
+/**
+ * Skip data in the ring buffer, consumer only
+ *
+ * @param ring Ring buffer
+ * @param sz   Number of bytes to skip, at most aubuf_ring_used()
+ */
+void aubuf_ring_skip(struct aubuf_ring *ring, size_t sz)
+{
+	pos_store(ring, &ring->rpos, ring->rpos + sz);
+}
+
+
+/**
+ * Get the number of bytes in the ring buffer
+ *
+ * @param ring Ring buffer
+ *
+ * @return Number of bytes
+ */
+size_t aubuf_ring_used(const struct aubuf_ring *ring)
+{
+	/* the read position first, it is never ahead of the write
+	   position */
+	const size_t rpos = pos_load(ring, &ring->rpos);
+
+	return pos_load(ring, &ring->wpos) - rpos;
+}
+
+
+/**
+ * Request a flush of the ring buffer, from any thread
+ *
+ * The data written so far is dropped by the consumer, when it calls
+ * aubuf_ring_flushed(). The request is the write position, in a single
+ * word. Concurrent requests advance it with a compare-and-swap, so that
+ * the latest position is kept and no request is lost.
+ *
+ * @param ring Ring buffer
+ */
+void aubuf_ring_flush(struct aubuf_ring *ring)
+{
+#ifdef RING_LOCK
+	lock_write_get(ring->lock);
+
+	if (ring->wpos - ring->flush_pos - 1 < SIZE_MAX / 2)
+		ring->flush_pos = ring->wpos;
+
+	lock_rel(ring->lock);
+#else
+	const size_t wpos = pos_load(ring, &ring->wpos);
+	size_t pos = __atomic_load_n(&ring->flush_pos, __ATOMIC_RELAXED);
+
+	/* only forward, another request may have a later position */
+	while (wpos - pos - 1 < SIZE_MAX / 2 &&
+	       !__atomic_compare_exchange_n(&ring->flush_pos, &pos, wpos,
+					    true, __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+		;
+#endif
+}
+
+
+/**
+ * Apply a pending flush request, consumer only
+ *
+ * @param ring Ring buffer
+ *
+ * @return True if the ring buffer was flushed, otherwise false
+ */
+bool aubuf_ring_flushed(struct aubuf_ring *ring)
+{
+	const size_t pos = pos_load(ring, &ring->flush_pos);
+	size_t skip;
+
+	if (pos == ring->flushed)
+		return false;
+
+	ring->flushed = pos;
+
+	/* skip up to the flush position, if not read already */
+	skip = pos - ring->rpos;
+	if (skip <= aubuf_ring_used(ring))
+		aubuf_ring_skip(ring, skip);
+
+	return true;
+}
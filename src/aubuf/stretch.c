@@ -0,0 +1,232 @@
+/**
+ * @file stretch.c  Audio Buffer -- time-scale modification
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <re.h>
+#include "aubuf.h"
+
+
+/*
+ * WSOLA-style time stretching
+ *
+ * The signal is shortened or lengthened by exactly one pitch period, by
+ * cross-fading two similar consecutive periods. The pitch period is
+ * searched on a mono signal decimated to 8000 Hz.
+ */
+
+
+enum {
+	SEARCH_SRATE = 8000,
+	SEARCH_MAX   = AUBUF_PITCH_MAX * SEARCH_SRATE / 1000,
+	SEARCH_MIN   = SEARCH_SRATE / 400,          /* 2.5 ms */
+	SILENCE_LVL  = 64 * 64,    /* mean square, below is silence */
+};
+
+
+/**
+ * Find the pitch period of a frame
+ *
+ * @param sampv Interleaved samples, at least 2 * AUBUF_PITCH_MAX ms
+ * @param ch    Number of channels
+ * @param srate Sample rate in [Hz]
+ *
+ * @return Pitch period in frames (samples per channel), or 0 if the
+ *         signal is not periodic enough to be stretched without
+ *         artefacts
+ */
+size_t aubuf_pitch(const int16_t *sampv, unsigned ch, uint32_t srate)
+{
+	int32_t x[2 * SEARCH_MAX];
+	const size_t dec = max(srate / SEARCH_SRATE, 1);
+	double best = 0.0;
+	uint64_t pow = 0;
+	size_t i, lag, best_lag = 0;
+	unsigned c;
+
+	/* mono downmix, decimated without a filter */
+	for (i=0; i<2*SEARCH_MAX; i++) {
+
+		int32_t v = 0;
+
+		for (c=0; c<ch; c++)
+			v += sampv[i*dec*ch + c];
+
+		x[i] = v / (int32_t)ch;
+		pow += (int64_t)x[i] * x[i];
+	}
+
+	/* silence can be cut anywhere */
+	if (pow / (2*SEARCH_MAX) < SILENCE_LVL)
+		return SEARCH_MAX * dec;
+
+	for (lag=SEARCH_MIN; lag<=SEARCH_MAX; lag++) {
+
+		int64_t xy = 0, xx = 0, yy = 0;
+		double corr;
+
+		for (i=0; i<lag; i++) {
+			xy += (int64_t)x[i] * x[i+lag];
+			xx += (int64_t)x[i] * x[i];
+			yy += (int64_t)x[i+lag] * x[i+lag];
+		}
+
+		if (xy <= 0 || !xx || !yy)
+			continue;
+
+		corr = (double)xy / sqrt((double)xx * (double)yy);
+
+		if (corr > best) {
+			best     = corr;
+			best_lag = lag;
+		}
+	}
+
+	if (best < 0.5)
+		return 0;
+
+	return best_lag * dec;
+}
+
+
+/**
+ * Remove one pitch period, by fading from the first into the second of
+ * two periods
+ *
+ * @param sampv Interleaved samples
+ * @param len   Number of frames, at least 2T
+ * @param t     Pitch period T in frames
+ * @param ch    Number of channels
+ *
+ * @return New number of frames, len - T
+ */
+size_t aubuf_accelerate(int16_t *sampv, size_t len, size_t t, unsigned ch)
+{
+	const size_t n = t * ch;
+	size_t i;
+
+	for (i=0; i<n; i++) {
+
+		const int32_t w = (int32_t)((i / ch) * 32768 / t);
+
+		sampv[i] = (int16_t)((sampv[i] * (32768 - w) +
+				      sampv[i + n] * w) >> 15);
+	}
+
+	memmove(&sampv[n], &sampv[2*n], (len - 2*t) * ch * 2);
+
+	return len - t;
+}
+
+
+/**
+ * Repeat one pitch period, by fading from the second period back into
+ * the first one
+ *
+ * @param sampv Interleaved samples, with room for len + T frames
+ * @param len   Number of frames, at least 2T
+ * @param t     Pitch period T in frames
+ * @param ch    Number of channels
+ *
+ * @return New number of frames, len + T
+ */
+size_t aubuf_expand(int16_t *sampv, size_t len, size_t t, unsigned ch)
+{
+	const size_t n = t * ch;
+	size_t i;
+
+	memmove(&sampv[2*n], &sampv[n], (len - t) * ch * 2);
+
+	for (i=0; i<n; i++) {
+
+		const int32_t w = (int32_t)((i / ch) * 32768 / t);
+
+		sampv[n + i] = (int16_t)((sampv[2*n + i] * (32768 - w) +
+					  sampv[i] * w) >> 15);
+	}
+
+	return len + t;
+}
+
+
+/* Find the quietest point between two frames, for a one-frame change */
+static size_t quiet_point(const int16_t *sampv, size_t n, unsigned ch)
+{
+	uint32_t best = UINT32_MAX;
+	size_t i, pos = 1;
+	unsigned c;
+
+	for (i=1; i<n; i++) {
+
+		uint32_t e = 0;
+
+		for (c=0; c<ch; c++) {
+			const int32_t a = sampv[(i-1)*ch + c];
+			const int32_t b = sampv[i*ch + c];
+
+			e += (uint32_t)(abs(a) + abs(b) + abs(b - a));
+		}
+
+		if (e < best) {
+			best = e;
+			pos  = i;
+		}
+	}
+
+	return pos;
+}
+
+
+/**
+ * Remove one frame at the quietest point, for clock drift compensation
+ *
+ * The two frames around the removed one are averaged.
+ *
+ * @param dst Output samples, n - 1 frames
+ * @param src Input samples, n frames, at least 2
+ * @param n   Number of input frames
+ * @param ch  Number of channels
+ */
+void aubuf_sample_drop(int16_t *dst, const int16_t *src, size_t n,
+		       unsigned ch)
+{
+	const size_t i = quiet_point(src, n, ch);
+	unsigned c;
+
+	memcpy(dst, src, (i - 1) * ch * 2);
+
+	for (c=0; c<ch; c++)
+		dst[(i-1)*ch + c] = (int16_t)((src[(i-1)*ch + c] +
+					       src[i*ch + c]) / 2);
+
+	memcpy(&dst[i*ch], &src[(i+1)*ch], (n - i - 1) * ch * 2);
+}
+
+
+/**
+ * Insert one frame at the quietest point, for clock drift compensation
+ *
+ * The inserted frame is the average of its two neighbours.
+ *
+ * @param dst Output samples, n + 1 frames
+ * @param src Input samples, n frames, at least 2
+ * @param n   Number of input frames
+ * @param ch  Number of channels
+ */
+void aubuf_sample_insert(int16_t *dst, const int16_t *src, size_t n,
+			 unsigned ch)
+{
+	const size_t i = quiet_point(src, n, ch);
+	unsigned c;
+
+	memcpy(dst, src, i * ch * 2);
+
+	for (c=0; c<ch; c++)
+		dst[i*ch + c] = (int16_t)((src[(i-1)*ch + c] +
+					   src[i*ch + c]) / 2);
+
+	memcpy(&dst[(i+1)*ch], &src[i*ch], (n - i) * ch * 2);
+}
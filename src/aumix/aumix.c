@@ -6,27 +6,83 @@
 
 #define _BSD_SOURCE 1
 #define _DEFAULT_SOURCE 1
-#include <unistd.h>
 #include <pthread.h>
 #include <string.h>
 #include <re.h>
 #include <rem_au.h>
 #include <rem_aubuf.h>
 #include <rem_aufile.h>
+#include <rem_fir.h>
+#include <rem_auresamp.h>
 #include <rem_aumix.h>
+#include <rem_deadline.h>
+#include "aumix.h"
+
+
+enum {
+	SPEECH_LEVEL = 10000,   /* Mean square level, approx. -50 dBFS */
+};
+
+/* How the gain of a source is applied when it is added to the bus */
+enum gain_mode {
+	GAIN_UNITY,   /* no gain, plain add                  */
+	GAIN_CONST,   /* same constant gain on all channels  */
+	GAIN_RAMP,    /* gain ramp, or different gain per ch */
+};
+
+/* Why a source is silent in the current tick */
+enum silence {
+	SILENCE_NONE = 0,
+	SILENCE_UNDERRUN,   /* source buffer is empty or filling */
+	SILENCE_ZERO,       /* frame is digital silence          */
+	SILENCE_VAD,        /* no voice activity (DTX)           */
+};
 
 
 /** Defines an Audio mixer */
 struct aumix {
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
+	pthread_cond_t idle;          /* signalled when a tick is done */
 	struct list srcl;
 	pthread_t thread;
-	struct aufile *af;
+	struct deadline dl;
+	struct aumix_play *play;
+	struct aumix_prompt *prompt;
+	struct aumix_prompt *prompt_gc;  /* replaced, in use by the tick */
+	size_t prompt_pos;
+	const struct aumix_kern *kern;
+	struct aumix_pool *pool;
+	struct aumix_source **topv;
+	struct aumix_source **srcv;   /* sources of the current tick */
+	uint64_t *cbv;                /* frame handler time per source */
+	uint32_t srcc;
+	uint32_t srcsz;
+	int16_t *afframe;             /* announcement frame          */
+	int16_t *framev;              /* one mix frame per worker    */
+	int16_t *shared_frame;
+	const int16_t *base;
+	int32_t *bus;
+	struct {
+		uint64_t mixed;        /* source frames added to the bus */
+		uint64_t underrun;     /* silent source frames, by cause */
+		uint64_t zero;
+		uint64_t vad;
+		uint64_t play_late;    /* announcement prefetch late     */
+		uint64_t ticks;
+		uint64_t lock_sum;     /* mutex hold time per tick [ns]  */
+		uint64_t lock_max;
+		uint64_t cb_sum;       /* frame handler time per tick    */
+		uint64_t cb_max;
+	} stats;
+	uint32_t topk;
+	uint32_t hold;
 	uint32_t ptime;
 	uint32_t frame_size;
 	uint32_t srate;
 	uint8_t ch;
+	bool levels;
+	bool ticking;
 	bool run;
 };
 
@@ -34,13 +90,66 @@ struct aumix {
 struct aumix_source {
 	struct le le;
 	int16_t *frame;
+	int16_t *sframe;         /* frame in the source format        */
 	struct aubuf *aubuf;
+	struct auresamp rs_in;   /* source to mixer format            */
+	struct auresamp rs_out;  /* mixer to source format            */
+	uint32_t sframe_size;
 	struct aumix *mix;
 	aumix_frame_h *fh;
 	void *arg;
+	uint64_t score;
+	uint64_t hold_ts;
+	float gain;
+	float pan;
+	int16_t gainv[2];        /* target gain per channel (Q12)     */
+	int16_t curv[2];         /* gain per channel of the last tick */
+	bool inactive;
+	bool muted;
+	bool recvonly;
+	bool speaking;
+	bool busy;               /* in the snapshot of the running tick */
+
+	/* state of the current tick, used without the mutex */
+	int16_t g0[2];
+	int16_t g1[2];
+	uint32_t level;
+	enum gain_mode gmode;
+	enum silence silence;
+	bool read;
+	bool mixed;
 };
 
 
+static pthread_once_t tick_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tick_key;     /* mixer delivering on this thread */
+
+
+static void tick_key_init(void)
+{
+	(void)pthread_key_create(&tick_key, NULL);
+}
+
+
+/*
+ * Wait until the current tick is complete, with the mutex held.
+ * A frame handler of the mixer cannot wait for its own tick.
+ */
+static int tick_wait(struct aumix *mix)
+{
+	if (!mix->ticking)
+		return 0;
+
+	if (pthread_getspecific(tick_key) == mix)
+		return EDEADLK;
+
+	while (mix->ticking)
+		pthread_cond_wait(&mix->idle, &mix->mutex);
+
+	return 0;
+}
+
+
 static void dummy_frame_handler(const int16_t *sampv, size_t sampc, void *arg)
 {
 	(void)sampv;
@@ -63,127 +172,656 @@ static void destructor(void *arg)
 		pthread_join(mix->thread, NULL);
 	}
 
-	mem_deref(mix->af);
+	mem_deref(mix->pool);
+	mem_deref(mix->topv);
+	mem_deref(mix->srcv);
+	mem_deref(mix->cbv);
+	mem_deref(mix->afframe);
+	mem_deref(mix->framev);
+	mem_deref(mix->shared_frame);
+	mem_deref(mix->bus);
+	mem_deref(mix->play);
+	aumix_prompt_put(mix->prompt);
+	aumix_prompt_put(mix->prompt_gc);
 }
 
 
 static void source_destructor(void *arg)
 {
 	struct aumix_source *src = arg;
+	struct aumix *mix = src->mix;
+	uint32_t i;
 
-	if (src->le.list) {
-		pthread_mutex_lock(&src->mix->mutex);
-		list_unlink(&src->le);
-		pthread_mutex_unlock(&src->mix->mutex);
+	pthread_mutex_lock(&mix->mutex);
+
+	list_unlink(&src->le);
+
+	/* destroyed from a frame handler, remove it from the tick */
+	if (src->busy && tick_wait(mix)) {
+		for (i=0; i<mix->srcc; i++) {
+			if (mix->srcv[i] == src)
+				mix->srcv[i] = NULL;
+		}
 	}
 
+	pthread_mutex_unlock(&mix->mutex);
+
 	mem_deref(src->aubuf);
 	mem_deref(src->frame);
+	mem_deref(src->sframe);
+	auresamp_reset(&src->rs_in);
+	auresamp_reset(&src->rs_out);
 	mem_deref(src->mix);
 }
 
 
-static void *aumix_thread(void *arg)
+/* Convert a linear gain to Q12 fixed-point */
+static int16_t gain_q12(float gain)
+{
+	if (gain <= 0.0f)
+		return 0;
+
+	if (gain >= 32767.0f / AUMIX_GAIN_UNITY)
+		return 32767;
+
+	return (int16_t)(gain * AUMIX_GAIN_UNITY + 0.5f);
+}
+
+
+/* Update the target gain per channel, from gain, pan and mute */
+static void gain_update(struct aumix_source *src)
+{
+	float l = src->gain, r = src->gain;
+
+	if (src->mix->ch == 2) {
+
+		/* linear pan law, the center is unity on both channels */
+		if (src->pan > 0.0f)
+			l *= 1.0f - src->pan;
+		else
+			r *= 1.0f + src->pan;
+	}
+
+	src->gainv[0] = src->muted ? 0 : gain_q12(l);
+	src->gainv[1] = src->muted ? 0 : gain_q12(r);
+}
+
+
+static enum gain_mode gain_mode(const int16_t *g0, const int16_t *g1)
+{
+	if (g0[0] != g1[0] || g0[1] != g1[1])
+		return GAIN_RAMP;
+
+	if (g1[0] != g1[1])
+		return GAIN_RAMP;
+
+	if (g1[0] == AUMIX_GAIN_UNITY)
+		return GAIN_UNITY;
+
+	return GAIN_CONST;
+}
+
+
+/* Muted, and the fade-out is complete */
+static bool source_silent(const struct aumix_source *src)
+{
+	return src->muted && !src->curv[0] && !src->curv[1];
+}
+
+
+/*
+ * Select the K loudest sources as active speakers.
+ *
+ * Active speakers get a +3 dB bonus (hysteresis), and are held for
+ * the hold time after they last spoke, so that short pauses or a
+ * louder newcomer do not make the speaker set flap.
+ */
+static void speakers_update(struct aumix *mix, uint64_t now)
+{
+	struct aumix_source **topv = mix->topv;
+	const uint32_t k = mix->topk;
+	uint32_t i, j, n = 0;
+
+	for (j=0; j<mix->srcc; j++) {
+
+		struct aumix_source *src = mix->srcv[j];
+
+		/* a silent source is not a speaker, and takes no slot */
+		if (src->recvonly || source_silent(src) || src->silence) {
+			src->speaking = false;
+			continue;
+		}
+
+		src->score = src->level;
+
+		if (src->speaking) {
+
+			src->score *= 2;
+
+			if (now < src->hold_ts)
+				src->score |= 1ULL << 32;
+		}
+
+		src->speaking = false;
+
+		if (n == k && topv[k-1]->score >= src->score)
+			continue;
+
+		i = (n < k) ? n++ : k - 1;
+
+		while (i > 0 && topv[i-1]->score < src->score) {
+			topv[i] = topv[i-1];
+			--i;
+		}
+
+		topv[i] = src;
+	}
+
+	for (i=0; i<n; i++) {
+
+		topv[i]->speaking = true;
+
+		if (topv[i]->level >= SPEECH_LEVEL)
+			topv[i]->hold_ts = now + mix->hold;
+	}
+}
+
+
+/* Split a range of work items evenly between the workers */
+static void job_range(uint32_t *ap, uint32_t *bp, uint32_t total,
+		      unsigned idx, unsigned n, uint32_t align)
+{
+	uint32_t chunk = (total + n - 1) / n;
+
+	chunk = (chunk + align - 1) / align * align;
+
+	*ap = min(idx * chunk, total);
+	*bp = min(*ap + chunk, total);
+}
+
+
+/* Read a frame from the source, and convert it to the mixer format */
+static void source_read(struct aumix *mix, struct aumix_source *src)
+{
+	size_t outc = max(mix->frame_size, src->sframe_size);
+
+	if (!src->rs_in.resample) {
+		aubuf_read_samp(src->aubuf, src->frame, mix->frame_size);
+		return;
+	}
+
+	aubuf_read_samp(src->aubuf, src->sframe, src->sframe_size);
+
+	if (auresamp(&src->rs_in, src->frame, &outc, src->sframe,
+		     src->sframe_size) || outc != mix->frame_size)
+		memset(src->frame, 0, mix->frame_size*2);
+}
+
+
+/* Convert a mix frame to the source format, and deliver it */
+static void source_deliver(struct aumix *mix, struct aumix_source *src,
+			   const int16_t *frame)
+{
+	size_t outc = max(mix->frame_size, src->sframe_size);
+
+	if (!src->rs_out.resample) {
+		src->fh(frame, mix->frame_size, src->arg);
+		return;
+	}
+
+	if (auresamp(&src->rs_out, src->sframe, &outc, frame,
+		     mix->frame_size))
+		return;
+
+	src->fh(src->sframe, outc, src->arg);
+}
+
+
+/* Job: read a frame from each source, and measure its level */
+static void job_read(unsigned idx, unsigned n, void *arg)
 {
-	uint8_t *silence, *frame, *base_frame;
 	struct aumix *mix = arg;
-	int16_t *mix_frame;
-	uint64_t ts = 0;
+	uint32_t i, a, b;
 
-	silence   = mem_zalloc(mix->frame_size*2, NULL);
-	frame     = mem_alloc(mix->frame_size*2, NULL);
-	mix_frame = mem_alloc(mix->frame_size*2, NULL);
+	job_range(&a, &b, mix->srcc, idx, n, 1);
 
-	if (!silence || !frame || !mix_frame)
-		goto out;
+	for (i=a; i<b; i++) {
 
-	pthread_mutex_lock(&mix->mutex);
+		struct aumix_source *src = mix->srcv[i];
+		bool underrun;
 
-	while (mix->run) {
+		if (!src->read)
+			continue;
 
-		struct le *le;
-		uint64_t now;
+		underrun = aubuf_cur_size(src->aubuf) < src->sframe_size*2;
 
-		if (!mix->srcl.head) {
-			mix->af = mem_deref(mix->af);
-			pthread_cond_wait(&mix->cond, &mix->mutex);
-			ts = 0;
+		source_read(mix, src);
+
+		if (underrun)
+			src->silence = SILENCE_UNDERRUN;
+		else if (aumix_is_zero(src->frame, mix->frame_size))
+			src->silence = SILENCE_ZERO;
+		else
+			src->silence = SILENCE_NONE;
+
+		if (!mix->levels)
+			continue;
+
+		if (src->silence)
+			src->level = 0;
+		else
+			src->level = aumix_level(src->frame, mix->frame_size);
+	}
+}
+
+
+/* Job: build a slice of the total-sum bus */
+static void job_bus(unsigned idx, unsigned n, void *arg)
+{
+	struct aumix *mix = arg;
+	const struct aumix_kern *kern = mix->kern;
+	const unsigned ch = mix->ch == 2 ? 2 : 1;
+	uint32_t i, a, b;
+
+	job_range(&a, &b, mix->frame_size, idx, n, 16);
+	if (a == b)
+		return;
+
+	kern->bus_init(&mix->bus[a], mix->base ? &mix->base[a] : NULL,
+		       b - a);
+
+	for (i=0; i<mix->srcc; i++) {
+
+		struct aumix_source *src = mix->srcv[i];
+
+		if (!src->mixed)
+			continue;
+
+		/* the gain is applied to the source frame in-place,
+		   so that mix-minus removes the scaled frame */
+		switch (src->gmode) {
+
+		case GAIN_UNITY:
+			kern->bus_add(&mix->bus[a], &src->frame[a], b - a);
+			break;
+
+		case GAIN_CONST:
+			kern->bus_add_gain(&mix->bus[a], &src->frame[a],
+					   src->g1[0], b - a);
+			break;
+
+		case GAIN_RAMP:
+			aumix_bus_add_ramp(&mix->bus[a], &src->frame[a],
+					   b - a, ch, src->g0, src->g1,
+					   a, mix->frame_size);
+			break;
+		}
+	}
+}
+
+
+/* Job: create the listener frames and call the frame handlers */
+static void job_deliver(unsigned idx, unsigned n, void *arg)
+{
+	struct aumix *mix = arg;
+	int16_t *mix_frame = &mix->framev[idx * mix->frame_size];
+	uint32_t i, a, b;
+
+	job_range(&a, &b, mix->srcc, idx, n, 1);
+
+	(void)pthread_setspecific(tick_key, mix);
+
+	for (i=a; i<b; i++) {
+
+		struct aumix_source *src = mix->srcv[i];
+		const int16_t *frame = mix->shared_frame;
+		uint64_t t0;
+
+		/* destroyed by a frame handler */
+		if (!src) {
+			mix->cbv[i] = 0;
+			continue;
+		}
+
+		/* mix-minus: the bus without the listener itself,
+		   if not in the mix use the shared bus frame */
+		if (src->mixed) {
+			mix->kern->bus_get_minus(mix_frame, mix->bus,
+						 src->frame, mix->frame_size);
+			frame = mix_frame;
+		}
+
+		t0 = deadline_now();
+		source_deliver(mix, src, frame);
+		mix->cbv[i] = deadline_now() - t0;
+	}
+
+	(void)pthread_setspecific(tick_key, NULL);
+}
+
+
+/*
+ * Take a snapshot of the source list, for the workers. The sources are
+ * marked busy, and a source that is destroyed during the tick waits in
+ * its destructor until the tick is complete.
+ */
+static int sources_snapshot(struct aumix *mix)
+{
+	struct le *le;
+	uint32_t i, n = 0;
+
+	for (le=mix->srcl.head; le; le=le->next) {
+
+		if (n == mix->srcsz) {
+
+			struct aumix_source **srcv;
+			uint64_t *cbv;
+			uint32_t sz = mix->srcsz ? mix->srcsz * 2 : 16;
+
+			srcv = mem_realloc(mix->srcv, sz * sizeof(*srcv));
+			if (!srcv)
+				return ENOMEM;
+
+			mix->srcv = srcv;
+
+			cbv = mem_realloc(mix->cbv, sz * sizeof(*cbv));
+			if (!cbv)
+				return ENOMEM;
+
+			mix->cbv   = cbv;
+			mix->srcsz = sz;
+		}
+
+		mix->srcv[n++] = le->data;
+	}
+
+	for (i=0; i<n; i++)
+		mix->srcv[i]->busy = true;
+
+	mix->srcc = n;
+
+	return 0;
+}
+
+
+/*
+ * Start a tick, with the mutex held: get the announcement frame, and
+ * take a snapshot of the sources and their settings.
+ */
+static int tick_begin(struct aumix *mix)
+{
+	uint32_t i;
+	int err;
+
+	mix->base = NULL;
+
+	if (mix->prompt) {
+
+		const int16_t *sampv;
+		size_t sampc, n;
+
+		sampv = aumix_prompt_samp(mix->prompt, &sampc);
+		n = min(sampc - mix->prompt_pos, mix->frame_size);
+
+		/* play directly from the shared prompt */
+		if (n == mix->frame_size) {
+			mix->base = &sampv[mix->prompt_pos];
+		}
+		else if (n) {
+			memcpy(mix->afframe, &sampv[mix->prompt_pos], n*2);
+			memset(&mix->afframe[n], 0, (mix->frame_size - n)*2);
+			mix->base = mix->afframe;
 		}
 		else {
-			pthread_mutex_unlock(&mix->mutex);
-			(void)usleep(4000);
-			pthread_mutex_lock(&mix->mutex);
+			aumix_prompt_put(mix->prompt);
+			mix->prompt = NULL;
 		}
 
-		now = tmr_jiffies();
-		if (!ts)
-			ts = now;
+		mix->prompt_pos += n;
+	}
+	else if (mix->play) {
 
-		if (ts > now)
-			continue;
+		err = aumix_play_read(mix->play, mix->afframe,
+				      mix->frame_size);
 
-		if (mix->af) {
+		if (err == EAGAIN)
+			++mix->stats.play_late;
 
-			size_t n = mix->frame_size*2;
+		/* at the end of the file the reader has exited,
+		   so this does not block */
+		if (err == ENODATA)
+			mix->play = mem_deref(mix->play);
+		else
+			mix->base = mix->afframe;
+	}
 
-			if (aufile_read(mix->af, frame, &n) || n == 0) {
-				mix->af = mem_deref(mix->af);
-				base_frame = silence;
-			}
-			else if (n < mix->frame_size*2) {
-				memset(frame + n, 0, mix->frame_size*2 - n);
-				mix->af = mem_deref(mix->af);
-				base_frame = frame;
-			}
-			else {
-				base_frame = frame;
+	err = sources_snapshot(mix);
+	if (err)
+		return err;
+
+	for (i=0; i<mix->srcc; i++) {
+
+		struct aumix_source *src = mix->srcv[i];
+
+		src->read = !src->recvonly;
+	}
+
+	mix->levels  = mix->topk > 0;
+	mix->ticking = true;
+
+	return 0;
+}
+
+
+/*
+ * Select the sources to mix, with the mutex held. Returns true if any
+ * listener needs the shared frame.
+ */
+static bool tick_select(struct aumix *mix, uint64_t now)
+{
+	bool shared = false;
+	uint32_t i;
+
+	for (i=0; i<mix->srcc; i++) {
+
+		struct aumix_source *src = mix->srcv[i];
+
+		if (src->read && src->inactive &&
+		    src->silence != SILENCE_UNDERRUN) {
+			src->silence = SILENCE_VAD;
+			src->level   = 0;
+		}
+	}
+
+	if (mix->topk)
+		speakers_update(mix, now);
+
+	for (i=0; i<mix->srcc; i++) {
+
+		struct aumix_source *src = mix->srcv[i];
+
+		src->mixed = src->read && !src->recvonly &&
+			!source_silent(src) && (!mix->topk || src->speaking);
+
+		/* a silent source adds nothing, and its listener
+		   gets the shared frame */
+		if (src->mixed) {
+			switch (src->silence) {
+
+			case SILENCE_UNDERRUN:
+				++mix->stats.underrun;
+				src->mixed = false;
+				break;
+
+			case SILENCE_ZERO:
+				++mix->stats.zero;
+				src->mixed = false;
+				break;
+
+			case SILENCE_VAD:
+				++mix->stats.vad;
+				src->mixed = false;
+				break;
+
+			default:
+				++mix->stats.mixed;
+				break;
 			}
 		}
+
+		if (!src->mixed) {
+			shared = true;
+			continue;
+		}
+
+		/* the gain is ramped from the last to the current target */
+		src->g0[0] = src->curv[0];
+		src->g0[1] = src->curv[1];
+		src->g1[0] = src->gainv[0];
+		src->g1[1] = src->gainv[1];
+		src->gmode = gain_mode(src->g0, src->g1);
+	}
+
+	return shared;
+}
+
+
+/* Complete a tick, with the mutex held */
+static void tick_end(struct aumix *mix)
+{
+	uint64_t cb_ns = 0;
+	uint32_t i;
+
+	for (i=0; i<mix->srcc; i++) {
+
+		struct aumix_source *src = mix->srcv[i];
+
+		cb_ns += mix->cbv[i];
+
+		/* destroyed by a frame handler */
+		if (!src)
+			continue;
+
+		src->busy = false;
+
+		/* gain ramps are complete */
+		if (src->mixed) {
+			src->curv[0] = src->g1[0];
+			src->curv[1] = src->g1[1];
+		}
 		else {
-			base_frame = silence;
+			src->curv[0] = src->gainv[0];
+			src->curv[1] = src->gainv[1];
 		}
+	}
 
-		for (le=mix->srcl.head; le; le=le->next) {
+	mix->stats.cb_sum += cb_ns;
+	mix->stats.cb_max  = max(mix->stats.cb_max, cb_ns);
 
-			struct aumix_source *src = le->data;
+	/* the replaced prompt is no longer used */
+	aumix_prompt_put(mix->prompt_gc);
+	mix->prompt_gc = NULL;
 
-			aubuf_read_samp(src->aubuf, src->frame,
-					mix->frame_size);
+	mix->ticking = false;
+	pthread_cond_broadcast(&mix->idle);
+}
+
+
+/*
+ * The mixer thread
+ *
+ * The mutex is held only to take a snapshot of the sources, to select
+ * the sources to mix, and to complete the tick. Reading, mixing and
+ * calling the frame handlers is done without the mutex, so that the
+ * sources can be controlled concurrently. Operations that free memory
+ * used by the tick wait for the tick to complete.
+ */
+static void *aumix_thread(void *arg)
+{
+	struct aumix *mix = arg;
+	struct deadline dl;
+
+	deadline_init(&dl, mix->ptime * 1000000ULL);
+
+	pthread_mutex_lock(&mix->mutex);
+
+	while (mix->run) {
+
+		uint64_t now, t0, lock_ns;
+		bool shared;
+
+		if (!mix->srcl.head) {
+
+			aumix_prompt_put(mix->prompt);
+			mix->prompt = NULL;
+
+			/* the reader may be in blocking I/O, so the
+			   announcement is stopped without the lock held */
+			if (mix->play) {
+				struct aumix_play *play = mix->play;
+
+				mix->play = NULL;
+				pthread_mutex_unlock(&mix->mutex);
+				mem_deref(play);
+				pthread_mutex_lock(&mix->mutex);
+				continue;
+			}
+
+			pthread_cond_wait(&mix->cond, &mix->mutex);
+
+			/* restart the schedule, with a tick right now */
+			dl.next = deadline_now();
+			continue;
 		}
 
-		for (le=mix->srcl.head; le; le=le->next) {
+		pthread_mutex_unlock(&mix->mutex);
+		(void)deadline_wait(&dl);
+		pthread_mutex_lock(&mix->mutex);
+
+		t0 = deadline_now();
+
+		mix->dl = dl;
+
+		if (!mix->run || !mix->srcl.head)
+			continue;
 
-			struct aumix_source *src = le->data;
-			struct le *cle;
+		now = tmr_jiffies();
+
+		if (tick_begin(mix))
+			continue;
+
+		lock_ns = deadline_now() - t0;
+		pthread_mutex_unlock(&mix->mutex);
+
+		aumix_pool_run(mix->pool, job_read, mix);
+
+		pthread_mutex_lock(&mix->mutex);
+		t0 = deadline_now();
+		shared = tick_select(mix, now);
+		lock_ns += deadline_now() - t0;
+		pthread_mutex_unlock(&mix->mutex);
 
-			memcpy(mix_frame, base_frame, mix->frame_size*2);
+		/* total-sum bus of the announcement and all mixed sources */
+		aumix_pool_run(mix->pool, job_bus, mix);
 
-			for (cle=mix->srcl.head; cle; cle=cle->next) {
+		if (shared)
+			mix->kern->bus_get(mix->shared_frame, mix->bus,
+					   mix->frame_size);
 
-				struct aumix_source *csrc = cle->data;
-				size_t i;
-#if 1
-				/* skip self */
-				if (csrc == src)
-					continue;
-#endif
-				for (i=0; i<mix->frame_size; i++)
-					mix_frame[i] += csrc->frame[i];
-			}
+		aumix_pool_run(mix->pool, job_deliver, mix);
 
-			src->fh(mix_frame, mix->frame_size, src->arg);
-		}
+		pthread_mutex_lock(&mix->mutex);
+		t0 = deadline_now();
+		tick_end(mix);
+		lock_ns += deadline_now() - t0;
 
-		ts += mix->ptime;
+		++mix->stats.ticks;
+		mix->stats.lock_sum += lock_ns;
+		mix->stats.lock_max  = max(mix->stats.lock_max, lock_ns);
 	}
 
 	pthread_mutex_unlock(&mix->mutex);
 
- out:
-	mem_deref(mix_frame);
-	mem_deref(silence);
-	mem_deref(frame);
-
 	return NULL;
 }
 
@@ -215,6 +853,18 @@ int aumix_alloc(struct aumix **mixp, uint32_t srate,
 	mix->frame_size = srate * ch * ptime / 1000;
 	mix->srate      = srate;
 	mix->ch         = ch;
+	mix->kern       = aumix_kern_get();
+
+	mix->afframe      = mem_alloc(mix->frame_size*2, NULL);
+	mix->framev       = mem_alloc(mix->frame_size*2, NULL);
+	mix->shared_frame = mem_alloc(mix->frame_size*2, NULL);
+	mix->bus          = mem_alloc(mix->frame_size*4, NULL);
+
+	if (!mix->afframe || !mix->framev || !mix->shared_frame ||
+	    !mix->bus) {
+		err = ENOMEM;
+		goto out;
+	}
 
 	err = pthread_mutex_init(&mix->mutex, NULL);
 	if (err)
@@ -224,6 +874,14 @@ int aumix_alloc(struct aumix **mixp, uint32_t srate,
 	if (err)
 		goto out;
 
+	err = pthread_cond_init(&mix->idle, NULL);
+	if (err)
+		goto out;
+
+	err = pthread_once(&tick_once, tick_key_init);
+	if (err)
+		goto out;
+
 	mix->run = true;
 
 	err = pthread_create(&mix->thread, NULL, aumix_thread, mix);
@@ -245,6 +903,10 @@ int aumix_alloc(struct aumix **mixp, uint32_t srate,
 /**
  * Load audio file for mixer announcements
  *
+ * Audio files are decoded once to the mixer format, and kept in a cache
+ * that is shared by all mixers, for as long as the file is played
+ * somewhere. Large files are read while playing instead.
+ *
  * @param mix      Audio mixer
  * @param filepath Filename of audio file with complete path
  *
@@ -252,6 +914,8 @@ int aumix_alloc(struct aumix **mixp, uint32_t srate,
  */
 int aumix_playfile(struct aumix *mix, const char *filepath)
 {
+	struct aumix_play *play = NULL, *old_play;
+	struct aumix_prompt *prompt = NULL, *old_prompt;
 	struct aufile_prm prm;
 	struct aufile *af;
 	int err;
@@ -259,6 +923,12 @@ int aumix_playfile(struct aumix *mix, const char *filepath)
 	if (!mix || !filepath)
 		return EINVAL;
 
+	err = aumix_prompt_get(&prompt, filepath, mix->srate, mix->ch);
+	if (!err)
+		goto out;
+	else if (err != EFBIG)
+		return err;
+
 	err = aufile_open(&af, &prm, filepath, AUFILE_READ);
 	if (err)
 		return err;
@@ -269,15 +939,236 @@ int aumix_playfile(struct aumix *mix, const char *filepath)
 		return EINVAL;
 	}
 
+	err = aumix_play_alloc(&play, af, mix->frame_size);
+	mem_deref(af);
+	if (err)
+		return err;
+
+ out:
+	pthread_mutex_lock(&mix->mutex);
+	old_play        = mix->play;
+	old_prompt      = mix->prompt;
+	mix->play       = play;
+	mix->prompt     = prompt;
+	mix->prompt_pos = 0;
+
+	/* the running tick may mix from the old prompt, or from the
+	   prompt that was replaced before it in the same tick */
+	if (mix->ticking && old_prompt && !mix->prompt_gc) {
+		mix->prompt_gc = old_prompt;
+		old_prompt = NULL;
+	}
+
+	pthread_mutex_unlock(&mix->mutex);
+
+	aumix_prompt_put(old_prompt);
+	mem_deref(old_play);
+
+	return 0;
+}
+
+
+/**
+ * Set the number of worker threads of the audio mixer
+ *
+ * Reading the sources, building the mix bus and creating the listener
+ * frames is spread over the workers every packet time.
+ *
+ * @param mix Audio mixer
+ * @param n   Number of workers, including the mixer thread (default 1)
+ *
+ * @return 0 for success, otherwise error code
+ *
+ * @note With more than one worker, the frame handlers of different
+ *       sources can be called concurrently from different threads.
+ *       Must not be called from a frame handler.
+ */
+int aumix_set_workers(struct aumix *mix, unsigned n)
+{
+	struct aumix_pool *pool = NULL, *old_pool;
+	int16_t *framev, *old_framev;
+	int err;
+
+	if (!mix || !n)
+		return EINVAL;
+
+	if (n > 1) {
+		err = aumix_pool_alloc(&pool, n);
+		if (err)
+			return err;
+	}
+
+	framev = mem_alloc(n * mix->frame_size*2, NULL);
+	if (!framev) {
+		mem_deref(pool);
+		return ENOMEM;
+	}
+
+	pthread_mutex_lock(&mix->mutex);
+
+	err = tick_wait(mix);
+	if (err) {
+		pthread_mutex_unlock(&mix->mutex);
+		mem_deref(framev);
+		mem_deref(pool);
+		return err;
+	}
+
+	old_pool    = mix->pool;
+	old_framev  = mix->framev;
+	mix->pool   = pool;
+	mix->framev = framev;
+
+	pthread_mutex_unlock(&mix->mutex);
+
+	mem_deref(old_framev);
+	mem_deref(old_pool);
+
+	return 0;
+}
+
+
+/**
+ * Enable or disable mixing of only the loudest speakers
+ *
+ * When enabled, the level of each source is measured every packet time,
+ * and only the K loudest sources are mixed. The mixing cost is then
+ * bounded by K instead of the number of sources.
+ *
+ * @param mix  Audio mixer
+ * @param k    Maximum number of mixed speakers, 0 to mix all sources
+ * @param hold Time in [ms] an active speaker is kept after it went quiet
+ *
+ * @return 0 for success, otherwise error code
+ */
+int aumix_set_topk(struct aumix *mix, uint32_t k, uint32_t hold)
+{
+	struct aumix_source **topv = NULL;
+	struct le *le;
+
+	if (!mix)
+		return EINVAL;
+
+	if (k) {
+		topv = mem_zalloc(k * sizeof(*topv), NULL);
+		if (!topv)
+			return ENOMEM;
+	}
+
 	pthread_mutex_lock(&mix->mutex);
-	mem_deref(mix->af);
-	mix->af = af;
+
+	mem_deref(mix->topv);
+	mix->topv = topv;
+	mix->topk = k;
+	mix->hold = hold;
+
+	for (le=mix->srcl.head; le; le=le->next) {
+
+		struct aumix_source *src = le->data;
+
+		src->speaking = false;
+	}
+
 	pthread_mutex_unlock(&mix->mutex);
 
 	return 0;
 }
 
 
+/**
+ * Get the active speakers of the audio mixer
+ *
+ * @param mix  Audio mixer
+ * @param srcv Array of audio sources, to hold the active speakers
+ * @param srcc Maximum number of entries in the array
+ *
+ * @return Number of active speakers returned
+ *
+ * @note Only valid if loudest speaker mixing is enabled. The returned
+ *       sources are referenced, and must be dereferenced by the caller.
+ */
+uint32_t aumix_speakers(struct aumix *mix, struct aumix_source **srcv,
+			uint32_t srcc)
+{
+	struct le *le;
+	uint32_t n = 0;
+
+	if (!mix || !srcv)
+		return 0;
+
+	pthread_mutex_lock(&mix->mutex);
+
+	for (le=mix->srcl.head; le && n < srcc; le=le->next) {
+
+		struct aumix_source *src = le->data;
+
+		if (src->speaking)
+			srcv[n++] = mem_ref(src);
+	}
+
+	pthread_mutex_unlock(&mix->mutex);
+
+	return n;
+}
+
+
+/**
+ * Audio mixer debug handler, use with fmt %H
+ *
+ * @param pf  Print function
+ * @param mix Audio mixer
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aumix_debug(struct re_printf *pf, struct aumix *mix)
+{
+	struct deadline dl;
+	uint64_t mixed, underrun, zero, vad, play_late;
+	uint64_t ticks, lock_sum, lock_max, cb_sum, cb_max;
+	uint32_t srcc;
+	unsigned workers;
+
+	if (!mix)
+		return 0;
+
+	pthread_mutex_lock(&mix->mutex);
+	dl        = mix->dl;
+	srcc      = list_count(&mix->srcl);
+	workers   = aumix_pool_size(mix->pool);
+	mixed     = mix->stats.mixed;
+	underrun  = mix->stats.underrun;
+	zero      = mix->stats.zero;
+	vad       = mix->stats.vad;
+	play_late = mix->stats.play_late;
+	ticks     = mix->stats.ticks;
+	lock_sum  = mix->stats.lock_sum;
+	lock_max  = mix->stats.lock_max;
+	cb_sum    = mix->stats.cb_sum;
+	cb_max    = mix->stats.cb_max;
+	pthread_mutex_unlock(&mix->mutex);
+
+	if (ticks) {
+		lock_sum /= ticks;
+		cb_sum   /= ticks;
+	}
+
+	return re_hprintf(pf, "aumix: srate=%u ch=%u ptime=%u sources=%u"
+			  " workers=%u\n"
+			  "  schedule: %H\n"
+			  "  frames: mixed=%llu silent=%llu"
+			  " (underrun=%llu zero=%llu vad=%llu)\n"
+			  "  announcement: late=%llu\n"
+			  "  per tick: lock avg=%lluus max=%lluus,"
+			  " handlers avg=%lluus max=%lluus\n",
+			  mix->srate, mix->ch, mix->ptime, srcc, workers,
+			  deadline_debug, &dl,
+			  mixed, underrun + zero + vad, underrun, zero, vad,
+			  play_late,
+			  lock_sum / 1000, lock_max / 1000,
+			  cb_sum / 1000, cb_max / 1000);
+}
+
+
 /**
  * Count number of audio sources in the audio mixer
  *
@@ -303,6 +1194,11 @@ uint32_t aumix_source_count(const struct aumix *mix)
  * @param arg  Handler argument
  *
  * @return 0 for success, otherwise error code
+ *
+ * @note A source that is destroyed while the mixer ticks waits until
+ *       the tick is complete, so that its frame handler is not called
+ *       afterwards. A source must not be destroyed from a frame handler,
+ *       disable it there with aumix_source_enable() instead.
  */
 int aumix_source_alloc(struct aumix_source **srcp, struct aumix *mix,
 		       aumix_frame_h *fh, void *arg)
@@ -318,9 +1214,18 @@ int aumix_source_alloc(struct aumix_source **srcp, struct aumix *mix,
 	if (!src)
 		return ENOMEM;
 
-	src->mix = mem_ref(mix);
-	src->fh  = fh ? fh : dummy_frame_handler;
-	src->arg = arg;
+	src->mix  = mem_ref(mix);
+	src->fh   = fh ? fh : dummy_frame_handler;
+	src->arg  = arg;
+	src->gain = 1.0f;
+
+	gain_update(src);
+	src->curv[0] = src->gainv[0];
+	src->curv[1] = src->gainv[1];
+
+	auresamp_init(&src->rs_in);
+	auresamp_init(&src->rs_out);
+	src->sframe_size = mix->frame_size;
 
 	sz = mix->frame_size*2;
 
@@ -330,7 +1235,7 @@ int aumix_source_alloc(struct aumix_source **srcp, struct aumix *mix,
 		goto out;
 	}
 
-	err = aubuf_alloc(&src->aubuf, sz * 6, sz * 12);
+	err = aubuf_alloc_ring(&src->aubuf, sz * 6, sz * 12);
 	if (err)
 		goto out;
 
@@ -344,6 +1249,118 @@ int aumix_source_alloc(struct aumix_source **srcp, struct aumix *mix,
 }
 
 
+/**
+ * Set the sample format of an aumix source
+ *
+ * By default a source has the same sample rate and channel count as the
+ * audio mixer. With a different format, the source samples are resampled
+ * to the mixer format when they are read, and the mix is resampled back
+ * to the source format before the frame handler is called.
+ *
+ * @param src   Audio mixer source
+ * @param srate Sample rate of the source in [Hz]
+ * @param ch    Number of channels of the source
+ *
+ * @return 0 for success, otherwise error code
+ *
+ * @note One packet time at the source rate must resample to a whole
+ *       mixer frame, e.g. 44100 Hz at 20 ms to 48000 Hz, otherwise
+ *       EINVAL is returned. Buffered samples are dropped, and the
+ *       source must not be written to while the format is changed.
+ *       Must not be called from a frame handler.
+ */
+int aumix_source_set_format(struct aumix_source *src, uint32_t srate,
+			    uint8_t ch)
+{
+	struct auresamp rs_in, rs_out, old_rs_in, old_rs_out;
+	struct aubuf *aubuf = NULL, *old_aubuf;
+	int16_t *frame = NULL, *sframe = NULL, *old_frame, *old_sframe;
+	struct aumix *mix;
+	uint32_t ssz;
+	size_t sz;
+	int err;
+
+	if (!src || !srate || !ch)
+		return EINVAL;
+
+	mix = src->mix;
+
+	/* whole source frames per packet, that resample to a whole
+	   mixer frame */
+	if ((uint64_t)srate * mix->ptime % 1000 ||
+	    (uint64_t)srate * mix->ptime / 1000 * mix->srate % srate)
+		return EINVAL;
+
+	auresamp_init(&rs_in);
+	auresamp_init(&rs_out);
+
+	err = auresamp_setup(&rs_in, srate, ch, mix->srate, mix->ch);
+	if (err)
+		goto out;
+
+	err = auresamp_setup(&rs_out, mix->srate, mix->ch, srate, ch);
+	if (err)
+		goto out;
+
+	ssz = srate * ch * mix->ptime / 1000;
+	sz  = max(ssz, mix->frame_size) * 2;
+
+	frame = mem_alloc(sz, NULL);
+	if (!frame) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	if (rs_in.resample) {
+		sframe = mem_alloc(sz, NULL);
+		if (!sframe) {
+			err = ENOMEM;
+			goto out;
+		}
+	}
+
+	err = aubuf_alloc_ring(&aubuf, ssz*2 * 6, ssz*2 * 12);
+	if (err)
+		goto out;
+
+	pthread_mutex_lock(&mix->mutex);
+
+	err = tick_wait(mix);
+	if (err) {
+		pthread_mutex_unlock(&mix->mutex);
+		goto out;
+	}
+
+	old_frame   = src->frame;
+	old_sframe  = src->sframe;
+	old_aubuf   = src->aubuf;
+	src->frame  = frame;
+	src->sframe = sframe;
+	src->aubuf  = aubuf;
+	frame       = old_frame;
+	sframe      = old_sframe;
+	aubuf       = old_aubuf;
+	old_rs_in   = src->rs_in;
+	old_rs_out  = src->rs_out;
+	src->rs_in       = rs_in;
+	src->rs_out      = rs_out;
+	src->sframe_size = ssz;
+	rs_in  = old_rs_in;
+	rs_out = old_rs_out;
+
+	pthread_mutex_unlock(&mix->mutex);
+
+ out:
+	auresamp_reset(&rs_in);
+	auresamp_reset(&rs_out);
+	mem_deref(aubuf);
+	mem_deref(sframe);
+	mem_deref(frame);
+
+	return err;
+}
+
+
 /**
  * Enable/disable aumix source
  *
@@ -373,12 +1390,136 @@ void aumix_source_enable(struct aumix_source *src, bool enable)
 	}
 	else {
 		list_unlink(&src->le);
+		src->speaking = false;
+
+		/* no frame handler call after return, unless called
+		   from a frame handler */
+		(void)tick_wait(mix);
 	}
 
 	pthread_mutex_unlock(&mix->mutex);
 }
 
 
+/**
+ * Set an aumix source to receive-only
+ *
+ * A receive-only source does not contribute to the mix. All receive-only
+ * sources get the same frame, which is computed only once per packet
+ * time. Samples written to a receive-only source are discarded.
+ *
+ * @param src      Audio mixer source
+ * @param recvonly True for receive-only, false to send and receive
+ */
+void aumix_source_set_recvonly(struct aumix_source *src, bool recvonly)
+{
+	struct aumix *mix;
+
+	if (!src)
+		return;
+
+	mix = src->mix;
+
+	pthread_mutex_lock(&mix->mutex);
+
+	src->recvonly = recvonly;
+	src->speaking = false;
+
+	pthread_mutex_unlock(&mix->mutex);
+
+	if (recvonly)
+		aubuf_flush(src->aubuf);
+}
+
+
+/**
+ * Set the gain of an aumix source
+ *
+ * The gain is applied while mixing, and changes are ramped over one
+ * packet time to avoid clicks.
+ *
+ * @param src  Audio mixer source
+ * @param gain Linear gain, 1.0 is unity (max. 8.0)
+ */
+void aumix_source_set_gain(struct aumix_source *src, float gain)
+{
+	if (!src)
+		return;
+
+	pthread_mutex_lock(&src->mix->mutex);
+	src->gain = gain;
+	gain_update(src);
+	pthread_mutex_unlock(&src->mix->mutex);
+}
+
+
+/**
+ * Mute or unmute an aumix source
+ *
+ * A muted source is faded out, and then no longer mixed. Listening to
+ * the mix is not affected.
+ *
+ * @param src  Audio mixer source
+ * @param mute True to mute, false to unmute
+ */
+void aumix_source_mute(struct aumix_source *src, bool mute)
+{
+	if (!src)
+		return;
+
+	pthread_mutex_lock(&src->mix->mutex);
+	src->muted = mute;
+	gain_update(src);
+	pthread_mutex_unlock(&src->mix->mutex);
+}
+
+
+/**
+ * Set the stereo panning of an aumix source
+ *
+ * Only applies if the audio mixer has 2 channels.
+ *
+ * @param src Audio mixer source
+ * @param pan Panning, from -1.0 (left) over 0.0 (center) to 1.0 (right)
+ */
+void aumix_source_set_pan(struct aumix_source *src, float pan)
+{
+	if (!src)
+		return;
+
+	if (pan < -1.0f)
+		pan = -1.0f;
+	else if (pan > 1.0f)
+		pan = 1.0f;
+
+	pthread_mutex_lock(&src->mix->mutex);
+	src->pan = pan;
+	gain_update(src);
+	pthread_mutex_unlock(&src->mix->mutex);
+}
+
+
+/**
+ * Set the voice activity of an aumix source
+ *
+ * Use this to pass a VAD or DTX decision of the codec to the mixer.
+ * While inactive, the source is not mixed, but its samples are still
+ * consumed.
+ *
+ * @param src    Audio mixer source
+ * @param active True if there is voice activity, otherwise false
+ */
+void aumix_source_set_vad(struct aumix_source *src, bool active)
+{
+	if (!src)
+		return;
+
+	pthread_mutex_lock(&src->mix->mutex);
+	src->inactive = !active;
+	pthread_mutex_unlock(&src->mix->mutex);
+}
+
+
 /**
  * Write PCM samples for a given source to the audio mixer
  *
@@ -387,6 +1528,8 @@ void aumix_source_enable(struct aumix_source *src, bool enable)
  * @param sampc Number of samples
  *
  * @return 0 for success, otherwise error code
+ *
+ * @note The samples of a source must be written from one thread at a time
  */
 int aumix_source_put(struct aumix_source *src, const int16_t *sampv,
 		     size_t sampc)
@@ -394,6 +1537,9 @@ int aumix_source_put(struct aumix_source *src, const int16_t *sampv,
 	if (!src || !sampv)
 		return EINVAL;
 
+	if (src->recvonly)
+		return 0;
+
 	return aubuf_write_samp(src->aubuf, sampv, sampc);
 }
 
@@ -0,0 +1,98 @@
+/**
+ * @file aumix/aumix.h  Audio Mixer -- internal API
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/*
+ * Mix bus kernels
+ *
+ * The mix bus is a 32-bit accumulator, which can hold the exact sum of
+ * up to 65536 full-scale 16-bit sources. Saturation to 16-bit is done
+ * only once, when a listener frame is taken from the bus.
+ *
+ * All kernel variants produce bit-identical output.
+ */
+
+/** Fixed-point precision of the gain kernel (Q12, 4096 is unity) */
+#define AUMIX_GAIN_SHIFT 12
+#define AUMIX_GAIN_UNITY (1 << AUMIX_GAIN_SHIFT)
+
+/** Mix bus kernel functions */
+struct aumix_kern {
+	const char *name;
+	void (*bus_init)(int32_t *bus, const int16_t *sampv, size_t sampc);
+	void (*bus_add)(int32_t *bus, const int16_t *sampv, size_t sampc);
+	void (*bus_add_gain)(int32_t *bus, int16_t *sampv, int16_t gain,
+			     size_t sampc);
+	void (*bus_get)(int16_t *outv, const int32_t *bus, size_t sampc);
+	void (*bus_get_minus)(int16_t *outv, const int32_t *bus,
+			      const int16_t *sampv, size_t sampc);
+};
+
+const struct aumix_kern *aumix_kern_get(void);
+
+extern const struct aumix_kern aumix_kern_c;
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define AUMIX_KERN_X86 1
+extern const struct aumix_kern aumix_kern_sse2;
+extern const struct aumix_kern aumix_kern_avx2;
+#endif
+
+#ifdef HAVE_NEON
+extern const struct aumix_kern aumix_kern_neon;
+#endif
+
+
+void aumix_bus_add_ramp(int32_t *bus, int16_t *sampv, size_t sampc,
+			unsigned ch, const int16_t *g0, const int16_t *g1,
+			size_t pos, size_t len);
+bool aumix_is_zero(const int16_t *sampv, size_t sampc);
+uint32_t aumix_level(const int16_t *sampv, size_t sampc);
+
+
+/*
+ * Worker pool
+ */
+
+struct aumix_pool;
+
+/**
+ * Job handler, called once by every worker in the pool
+ *
+ * @param idx Worker index, from 0 to n-1
+ * @param n   Number of workers
+ * @param arg Handler argument
+ */
+typedef void (aumix_job_h)(unsigned idx, unsigned n, void *arg);
+
+int  aumix_pool_alloc(struct aumix_pool **poolp, unsigned n);
+void aumix_pool_run(struct aumix_pool *pool, aumix_job_h *jobh, void *arg);
+unsigned aumix_pool_size(const struct aumix_pool *pool);
+
+
+/*
+ * Announcement player
+ */
+
+struct aumix_play;
+struct aufile;
+
+int aumix_play_alloc(struct aumix_play **playp, struct aufile *af,
+		     size_t frame_size);
+int aumix_play_read(struct aumix_play *play, int16_t *sampv, size_t sampc);
+
+
+/*
+ * Prompt cache
+ */
+
+struct aumix_prompt;
+
+int  aumix_prompt_get(struct aumix_prompt **pp, const char *path,
+		      uint32_t srate, uint8_t ch);
+void aumix_prompt_put(struct aumix_prompt *p);
+const int16_t *aumix_prompt_samp(const struct aumix_prompt *p,
+				 size_t *sampc);
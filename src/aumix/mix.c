@@ -0,0 +1,214 @@
+/**
+ * @file mix.c  Audio Mixer -- mix bus kernels
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include <rem_dsp.h>
+#include "aumix.h"
+
+
+/*
+ * Portable reference kernels
+ *
+ * NOTE: The loops below have no early exits and no aliasing between
+ *       input and output, so that the compiler can vectorize them.
+ */
+
+
+/* Initialize the mix bus with a base frame, or silence if NULL */
+static void bus_init(int32_t *restrict bus, const int16_t *restrict sampv,
+		     size_t sampc)
+{
+	size_t i;
+
+	if (!sampv) {
+		memset(bus, 0, sampc * sizeof(*bus));
+		return;
+	}
+
+	for (i=0; i<sampc; i++)
+		bus[i] = sampv[i];
+}
+
+
+/* Accumulate a source frame onto the mix bus */
+static void bus_add(int32_t *restrict bus, const int16_t *restrict sampv,
+		    size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i<sampc; i++)
+		bus[i] += sampv[i];
+}
+
+
+/*
+ * Scale a source frame in-place and accumulate it onto the mix bus.
+ * The scaled frame is kept, so that it can be removed again (mix-minus)
+ */
+static void bus_add_gain(int32_t *restrict bus, int16_t *restrict sampv,
+			 int16_t gain, size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i<sampc; i++) {
+
+		const int16_t v = saturate_s16((sampv[i] * gain) >>
+					       AUMIX_GAIN_SHIFT);
+
+		sampv[i] = v;
+		bus[i]  += v;
+	}
+}
+
+
+/* Get the saturated mix from the bus */
+static void bus_get(int16_t *restrict outv, const int32_t *restrict bus,
+		    size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i<sampc; i++)
+		outv[i] = saturate_s16(bus[i]);
+}
+
+
+/* Get the saturated mix from the bus, minus one source (mix-minus) */
+static void bus_get_minus(int16_t *restrict outv,
+			  const int32_t *restrict bus,
+			  const int16_t *restrict sampv, size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i<sampc; i++)
+		outv[i] = saturate_sub16(bus[i], sampv[i]);
+}
+
+
+const struct aumix_kern aumix_kern_c = {
+	"c",
+	bus_init,
+	bus_add,
+	bus_add_gain,
+	bus_get,
+	bus_get_minus,
+};
+
+
+/**
+ * Scale a slice of a source frame in-place with a per-channel linear gain
+ * ramp, and accumulate it onto the mix bus
+ *
+ * The ramp goes from g0 to g1 over the whole frame, and is the same for
+ * any split of the frame into slices. With g0 equal to g1 this applies a
+ * constant gain per channel (panning).
+ *
+ * @param bus   Mix bus slice
+ * @param sampv Source frame slice
+ * @param sampc Number of samples in the slice
+ * @param ch    Number of channels (1 or 2)
+ * @param g0    Gain per channel at the start of the frame (Q12)
+ * @param g1    Gain per channel at the end of the frame (Q12)
+ * @param pos   Position of the slice in the frame, in samples
+ * @param len   Length of the whole frame, in samples
+ */
+void aumix_bus_add_ramp(int32_t *restrict bus, int16_t *restrict sampv,
+			size_t sampc, unsigned ch, const int16_t *g0,
+			const int16_t *g1, size_t pos, size_t len)
+{
+	const size_t nframes = len / ch;
+	int64_t gq[2], step[2];
+	size_t i;
+	unsigned c;
+
+	for (c=0; c<ch; c++) {
+		step[c] = ((int64_t)(g1[c] - g0[c]) << 16) / (int64_t)nframes;
+		gq[c]   = ((int64_t)g0[c] << 16) + step[c] * (int64_t)(pos/ch);
+	}
+
+	for (i=0; i<sampc; i+=ch) {
+
+		for (c=0; c<ch; c++) {
+
+			const int32_t g = (int32_t)(gq[c] >> 16);
+			const int16_t v = saturate_s16((sampv[i+c] * g) >>
+						       AUMIX_GAIN_SHIFT);
+
+			sampv[i+c]  = v;
+			bus[i+c]   += v;
+			gq[c]      += step[c];
+		}
+	}
+}
+
+
+/**
+ * Check if a frame is digital silence
+ *
+ * @param sampv Samples
+ * @param sampc Number of samples
+ *
+ * @return True if all samples are zero, otherwise false
+ */
+bool aumix_is_zero(const int16_t *sampv, size_t sampc)
+{
+	int16_t acc = 0;
+	size_t i;
+
+	/* no early exit, so that the loop is vectorized */
+	for (i=0; i<sampc; i++)
+		acc |= sampv[i];
+
+	return acc == 0;
+}
+
+
+/**
+ * Calculate the level of a frame, as the mean of the squared samples
+ *
+ * @param sampv Samples
+ * @param sampc Number of samples
+ *
+ * @return Mean square level, from 0 to 2^30
+ */
+uint32_t aumix_level(const int16_t *sampv, size_t sampc)
+{
+	uint64_t sum = 0;
+	size_t i;
+
+	if (!sampc)
+		return 0;
+
+	for (i=0; i<sampc; i++)
+		sum += (int32_t)sampv[i] * sampv[i];
+
+	return (uint32_t)(sum / sampc);
+}
+
+
+/**
+ * Get the fastest mix bus kernels supported by the running CPU
+ *
+ * @return Mix bus kernels
+ */
+const struct aumix_kern *aumix_kern_get(void)
+{
+#ifdef AUMIX_KERN_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		return &aumix_kern_avx2;
+
+	if (__builtin_cpu_supports("sse2"))
+		return &aumix_kern_sse2;
+#endif
+
+#ifdef HAVE_NEON
+	return &aumix_kern_neon;
+#else
+	return &aumix_kern_c;
+#endif
+}
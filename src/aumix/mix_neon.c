@@ -0,0 +1,147 @@
+/**
+ * @file mix_neon.c  Audio Mixer -- NEON mix bus kernels
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include <rem_dsp.h>
+#include "aumix.h"
+
+
+#ifdef HAVE_NEON
+
+#include <arm_neon.h>
+
+
+/*
+ * NEON -- 8 samples per iteration
+ */
+
+
+static void neon_bus_init(int32_t *bus, const int16_t *sampv, size_t sampc)
+{
+	size_t i;
+
+	if (!sampv) {
+		memset(bus, 0, sampc * sizeof(*bus));
+		return;
+	}
+
+	for (i=0; i+8 <= sampc; i+=8) {
+
+		int16x8_t s = vld1q_s16(&sampv[i]);
+
+		vst1q_s32(&bus[i],   vmovl_s16(vget_low_s16(s)));
+		vst1q_s32(&bus[i+4], vmovl_s16(vget_high_s16(s)));
+	}
+
+	for (; i<sampc; i++)
+		bus[i] = sampv[i];
+}
+
+
+static void neon_bus_add(int32_t *bus, const int16_t *sampv, size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i+8 <= sampc; i+=8) {
+
+		int16x8_t s  = vld1q_s16(&sampv[i]);
+		int32x4_t b0 = vld1q_s32(&bus[i]);
+		int32x4_t b1 = vld1q_s32(&bus[i+4]);
+
+		vst1q_s32(&bus[i],   vaddw_s16(b0, vget_low_s16(s)));
+		vst1q_s32(&bus[i+4], vaddw_s16(b1, vget_high_s16(s)));
+	}
+
+	for (; i<sampc; i++)
+		bus[i] += sampv[i];
+}
+
+
+static void neon_bus_add_gain(int32_t *bus, int16_t *sampv, int16_t gain,
+			      size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i+8 <= sampc; i+=8) {
+
+		int16x8_t s  = vld1q_s16(&sampv[i]);
+		int32x4_t p0 = vmull_n_s16(vget_low_s16(s), gain);
+		int32x4_t p1 = vmull_n_s16(vget_high_s16(s), gain);
+		int32x4_t b0 = vld1q_s32(&bus[i]);
+		int32x4_t b1 = vld1q_s32(&bus[i+4]);
+		int16x4_t v0, v1;
+
+		v0 = vqmovn_s32(vshrq_n_s32(p0, AUMIX_GAIN_SHIFT));
+		v1 = vqmovn_s32(vshrq_n_s32(p1, AUMIX_GAIN_SHIFT));
+
+		vst1q_s16(&sampv[i], vcombine_s16(v0, v1));
+		vst1q_s32(&bus[i],   vaddw_s16(b0, v0));
+		vst1q_s32(&bus[i+4], vaddw_s16(b1, v1));
+	}
+
+	for (; i<sampc; i++) {
+
+		const int16_t v = saturate_s16((sampv[i] * gain) >>
+					       AUMIX_GAIN_SHIFT);
+
+		sampv[i] = v;
+		bus[i]  += v;
+	}
+}
+
+
+static void neon_bus_get(int16_t *outv, const int32_t *bus, size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i+8 <= sampc; i+=8) {
+
+		int16x4_t v0 = vqmovn_s32(vld1q_s32(&bus[i]));
+		int16x4_t v1 = vqmovn_s32(vld1q_s32(&bus[i+4]));
+
+		vst1q_s16(&outv[i], vcombine_s16(v0, v1));
+	}
+
+	for (; i<sampc; i++)
+		outv[i] = saturate_s16(bus[i]);
+}
+
+
+static void neon_bus_get_minus(int16_t *outv, const int32_t *bus,
+			       const int16_t *sampv, size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i+8 <= sampc; i+=8) {
+
+		int16x8_t s  = vld1q_s16(&sampv[i]);
+		int32x4_t b0 = vld1q_s32(&bus[i]);
+		int32x4_t b1 = vld1q_s32(&bus[i+4]);
+		int16x4_t v0, v1;
+
+		v0 = vqmovn_s32(vsubw_s16(b0, vget_low_s16(s)));
+		v1 = vqmovn_s32(vsubw_s16(b1, vget_high_s16(s)));
+
+		vst1q_s16(&outv[i], vcombine_s16(v0, v1));
+	}
+
+	for (; i<sampc; i++)
+		outv[i] = saturate_sub16(bus[i], sampv[i]);
+}
+
+
+const struct aumix_kern aumix_kern_neon = {
+	"neon",
+	neon_bus_init,
+	neon_bus_add,
+	neon_bus_add_gain,
+	neon_bus_get,
+	neon_bus_get_minus,
+};
+
+
+#endif
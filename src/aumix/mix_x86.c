@@ -0,0 +1,356 @@
+/**
+ * @file mix_x86.c  Audio Mixer -- SSE2 and AVX2 mix bus kernels
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include <rem_dsp.h>
+#include "aumix.h"
+
+
+#ifdef AUMIX_KERN_X86
+
+#include <immintrin.h>
+
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+
+/*
+ * Scalar tails, for the samples left over after the vector loops
+ */
+
+
+static inline void tail_init(int32_t *bus, const int16_t *sampv, size_t n)
+{
+	while (n--)
+		*bus++ = *sampv++;
+}
+
+
+static inline void tail_add(int32_t *bus, const int16_t *sampv, size_t n)
+{
+	while (n--)
+		*bus++ += *sampv++;
+}
+
+
+static inline void tail_add_gain(int32_t *bus, int16_t *sampv, int16_t gain,
+				 size_t n)
+{
+	while (n--) {
+
+		const int16_t v = saturate_s16((*sampv * gain) >>
+					       AUMIX_GAIN_SHIFT);
+
+		*sampv++ = v;
+		*bus++  += v;
+	}
+}
+
+
+static inline void tail_get(int16_t *outv, const int32_t *bus, size_t n)
+{
+	while (n--)
+		*outv++ = saturate_s16(*bus++);
+}
+
+
+static inline void tail_get_minus(int16_t *outv, const int32_t *bus,
+				  const int16_t *sampv, size_t n)
+{
+	while (n--)
+		*outv++ = saturate_sub16(*bus++, *sampv++);
+}
+
+
+/*
+ * SSE2 -- 8 samples per iteration
+ */
+
+
+SSE2 static void sse2_bus_init(int32_t *bus, const int16_t *sampv,
+			       size_t sampc)
+{
+	size_t i;
+
+	if (!sampv) {
+		memset(bus, 0, sampc * sizeof(*bus));
+		return;
+	}
+
+	for (i=0; i+8 <= sampc; i+=8) {
+
+		__m128i s    = _mm_loadu_si128((const __m128i *)&sampv[i]);
+		__m128i sign = _mm_srai_epi16(s, 15);
+
+		_mm_storeu_si128((__m128i *)&bus[i],
+				 _mm_unpacklo_epi16(s, sign));
+		_mm_storeu_si128((__m128i *)&bus[i+4],
+				 _mm_unpackhi_epi16(s, sign));
+	}
+
+	tail_init(&bus[i], &sampv[i], sampc - i);
+}
+
+
+SSE2 static void sse2_bus_add(int32_t *bus, const int16_t *sampv,
+			      size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i+8 <= sampc; i+=8) {
+
+		__m128i s    = _mm_loadu_si128((const __m128i *)&sampv[i]);
+		__m128i sign = _mm_srai_epi16(s, 15);
+		__m128i b0   = _mm_loadu_si128((const __m128i *)&bus[i]);
+		__m128i b1   = _mm_loadu_si128((const __m128i *)&bus[i+4]);
+
+		b0 = _mm_add_epi32(b0, _mm_unpacklo_epi16(s, sign));
+		b1 = _mm_add_epi32(b1, _mm_unpackhi_epi16(s, sign));
+
+		_mm_storeu_si128((__m128i *)&bus[i],   b0);
+		_mm_storeu_si128((__m128i *)&bus[i+4], b1);
+	}
+
+	tail_add(&bus[i], &sampv[i], sampc - i);
+}
+
+
+SSE2 static void sse2_bus_add_gain(int32_t *bus, int16_t *sampv,
+				   int16_t gain, size_t sampc)
+{
+	const __m128i g = _mm_set1_epi16(gain);
+	size_t i;
+
+	for (i=0; i+8 <= sampc; i+=8) {
+
+		__m128i s  = _mm_loadu_si128((const __m128i *)&sampv[i]);
+		__m128i lo = _mm_mullo_epi16(s, g);
+		__m128i hi = _mm_mulhi_epi16(s, g);
+		__m128i p0 = _mm_unpacklo_epi16(lo, hi);
+		__m128i p1 = _mm_unpackhi_epi16(lo, hi);
+		__m128i b0 = _mm_loadu_si128((const __m128i *)&bus[i]);
+		__m128i b1 = _mm_loadu_si128((const __m128i *)&bus[i+4]);
+		__m128i v, sign;
+
+		p0 = _mm_srai_epi32(p0, AUMIX_GAIN_SHIFT);
+		p1 = _mm_srai_epi32(p1, AUMIX_GAIN_SHIFT);
+
+		v    = _mm_packs_epi32(p0, p1);
+		sign = _mm_srai_epi16(v, 15);
+
+		b0 = _mm_add_epi32(b0, _mm_unpacklo_epi16(v, sign));
+		b1 = _mm_add_epi32(b1, _mm_unpackhi_epi16(v, sign));
+
+		_mm_storeu_si128((__m128i *)&sampv[i], v);
+		_mm_storeu_si128((__m128i *)&bus[i],   b0);
+		_mm_storeu_si128((__m128i *)&bus[i+4], b1);
+	}
+
+	tail_add_gain(&bus[i], &sampv[i], gain, sampc - i);
+}
+
+
+SSE2 static void sse2_bus_get(int16_t *outv, const int32_t *bus,
+			      size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i+8 <= sampc; i+=8) {
+
+		__m128i b0 = _mm_loadu_si128((const __m128i *)&bus[i]);
+		__m128i b1 = _mm_loadu_si128((const __m128i *)&bus[i+4]);
+
+		_mm_storeu_si128((__m128i *)&outv[i], _mm_packs_epi32(b0, b1));
+	}
+
+	tail_get(&outv[i], &bus[i], sampc - i);
+}
+
+
+SSE2 static void sse2_bus_get_minus(int16_t *outv, const int32_t *bus,
+				    const int16_t *sampv, size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i+8 <= sampc; i+=8) {
+
+		__m128i s    = _mm_loadu_si128((const __m128i *)&sampv[i]);
+		__m128i sign = _mm_srai_epi16(s, 15);
+		__m128i b0   = _mm_loadu_si128((const __m128i *)&bus[i]);
+		__m128i b1   = _mm_loadu_si128((const __m128i *)&bus[i+4]);
+
+		b0 = _mm_sub_epi32(b0, _mm_unpacklo_epi16(s, sign));
+		b1 = _mm_sub_epi32(b1, _mm_unpackhi_epi16(s, sign));
+
+		_mm_storeu_si128((__m128i *)&outv[i], _mm_packs_epi32(b0, b1));
+	}
+
+	tail_get_minus(&outv[i], &bus[i], &sampv[i], sampc - i);
+}
+
+
+const struct aumix_kern aumix_kern_sse2 = {
+	"sse2",
+	sse2_bus_init,
+	sse2_bus_add,
+	sse2_bus_add_gain,
+	sse2_bus_get,
+	sse2_bus_get_minus,
+};
+
+
+/*
+ * AVX2 -- 16 samples per iteration
+ */
+
+
+AVX2 static inline __m256i avx2_load_s16(const int16_t *p)
+{
+	return _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)p));
+}
+
+
+AVX2 static void avx2_bus_init(int32_t *bus, const int16_t *sampv,
+			       size_t sampc)
+{
+	size_t i;
+
+	if (!sampv) {
+		memset(bus, 0, sampc * sizeof(*bus));
+		return;
+	}
+
+	for (i=0; i+16 <= sampc; i+=16) {
+
+		_mm256_storeu_si256((__m256i *)&bus[i],
+				    avx2_load_s16(&sampv[i]));
+		_mm256_storeu_si256((__m256i *)&bus[i+8],
+				    avx2_load_s16(&sampv[i+8]));
+	}
+
+	tail_init(&bus[i], &sampv[i], sampc - i);
+}
+
+
+AVX2 static void avx2_bus_add(int32_t *bus, const int16_t *sampv,
+			      size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i+16 <= sampc; i+=16) {
+
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)&bus[i]);
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)&bus[i+8]);
+
+		b0 = _mm256_add_epi32(b0, avx2_load_s16(&sampv[i]));
+		b1 = _mm256_add_epi32(b1, avx2_load_s16(&sampv[i+8]));
+
+		_mm256_storeu_si256((__m256i *)&bus[i],   b0);
+		_mm256_storeu_si256((__m256i *)&bus[i+8], b1);
+	}
+
+	tail_add(&bus[i], &sampv[i], sampc - i);
+}
+
+
+AVX2 static void avx2_bus_add_gain(int32_t *bus, int16_t *sampv,
+				   int16_t gain, size_t sampc)
+{
+	const __m256i g = _mm256_set1_epi16(gain);
+	size_t i;
+
+	for (i=0; i+16 <= sampc; i+=16) {
+
+		__m256i s  = _mm256_loadu_si256((const __m256i *)&sampv[i]);
+		__m256i lo = _mm256_mullo_epi16(s, g);
+		__m256i hi = _mm256_mulhi_epi16(s, g);
+		__m256i p0 = _mm256_unpacklo_epi16(lo, hi);
+		__m256i p1 = _mm256_unpackhi_epi16(lo, hi);
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)&bus[i]);
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)&bus[i+8]);
+		__m256i v;
+
+		p0 = _mm256_srai_epi32(p0, AUMIX_GAIN_SHIFT);
+		p1 = _mm256_srai_epi32(p1, AUMIX_GAIN_SHIFT);
+
+		/* in-lane unpack and pack cancel out, order is kept */
+		v = _mm256_packs_epi32(p0, p1);
+
+		b0 = _mm256_add_epi32(b0, _mm256_cvtepi16_epi32(
+					      _mm256_castsi256_si128(v)));
+		b1 = _mm256_add_epi32(b1, _mm256_cvtepi16_epi32(
+					      _mm256_extracti128_si256(v, 1)));
+
+		_mm256_storeu_si256((__m256i *)&sampv[i], v);
+		_mm256_storeu_si256((__m256i *)&bus[i],   b0);
+		_mm256_storeu_si256((__m256i *)&bus[i+8], b1);
+	}
+
+	tail_add_gain(&bus[i], &sampv[i], gain, sampc - i);
+}
+
+
+AVX2 static inline void avx2_store_sat(int16_t *outv, __m256i b0, __m256i b1)
+{
+	__m256i v = _mm256_packs_epi32(b0, b1);
+
+	/* packs works per 128-bit lane, restore sample order */
+	v = _mm256_permute4x64_epi64(v, 0xd8);
+
+	_mm256_storeu_si256((__m256i *)outv, v);
+}
+
+
+AVX2 static void avx2_bus_get(int16_t *outv, const int32_t *bus,
+			      size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i+16 <= sampc; i+=16) {
+
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)&bus[i]);
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)&bus[i+8]);
+
+		avx2_store_sat(&outv[i], b0, b1);
+	}
+
+	tail_get(&outv[i], &bus[i], sampc - i);
+}
+
+
+AVX2 static void avx2_bus_get_minus(int16_t *outv, const int32_t *bus,
+				    const int16_t *sampv, size_t sampc)
+{
+	size_t i;
+
+	for (i=0; i+16 <= sampc; i+=16) {
+
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)&bus[i]);
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)&bus[i+8]);
+
+		b0 = _mm256_sub_epi32(b0, avx2_load_s16(&sampv[i]));
+		b1 = _mm256_sub_epi32(b1, avx2_load_s16(&sampv[i+8]));
+
+		avx2_store_sat(&outv[i], b0, b1);
+	}
+
+	tail_get_minus(&outv[i], &bus[i], &sampv[i], sampc - i);
+}
+
+
+const struct aumix_kern aumix_kern_avx2 = {
+	"avx2",
+	avx2_bus_init,
+	avx2_bus_add,
+	avx2_bus_add_gain,
+	avx2_bus_get,
+	avx2_bus_get_minus,
+};
+
+
+#endif
@@ -5,3 +5,9 @@
 #
 
 SRCS	+= aumix/aumix.c
+SRCS	+= aumix/mix.c
+SRCS	+= aumix/mix_neon.c
+SRCS	+= aumix/mix_x86.c
+SRCS	+= aumix/play.c
+SRCS	+= aumix/pool.c
+SRCS	+= aumix/prompt.c
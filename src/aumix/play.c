@@ -0,0 +1,233 @@
+/**
+ * @file play.c  Audio Mixer -- prefetching announcement playback
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <re.h>
+#include <rem_au.h>
+#include <rem_aufile.h>
+#include "aumix.h"
+
+
+enum {
+	PREFETCH_FRAMES = 25,   /* Size of the prefetch buffer, in frames */
+	CHUNK_FRAMES    = 5,    /* Frames read from the file at once      */
+};
+
+
+/**
+ * Defines an announcement player
+ *
+ * A reader thread reads the audio file ahead of time into a ring
+ * buffer, so that the mixer only copies samples from memory.
+ */
+struct aumix_play {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;      /* reader waits for free space */
+	pthread_t thread;
+	struct aufile *af;
+	int16_t *ringv;
+	int16_t *chunk;
+	size_t ringsz;            /* ring buffer size, in samples */
+	size_t rpos;
+	size_t fill;
+	size_t chunksz;
+	bool eof;
+	bool run;
+};
+
+
+static void *reader_thread(void *arg)
+{
+	struct aumix_play *play = arg;
+
+	for (;;) {
+
+		size_t n = play->chunksz * 2, wpos, k;
+		bool run;
+		int err;
+
+		pthread_mutex_lock(&play->mutex);
+
+		while (play->run && play->ringsz - play->fill < play->chunksz)
+			pthread_cond_wait(&play->cond, &play->mutex);
+
+		run = play->run;
+
+		pthread_mutex_unlock(&play->mutex);
+
+		if (!run)
+			break;
+
+		/* blocking I/O, without any lock held */
+		err = aufile_read(play->af, (uint8_t *)play->chunk, &n);
+		if (err)
+			n = 0;
+
+		pthread_mutex_lock(&play->mutex);
+
+		n /= 2;
+		wpos = (play->rpos + play->fill) % play->ringsz;
+
+		k = min(n, play->ringsz - wpos);
+
+		memcpy(&play->ringv[wpos], play->chunk, k * 2);
+		memcpy(play->ringv, &play->chunk[k], (n - k) * 2);
+
+		play->fill += n;
+
+		if (err || n < play->chunksz)
+			play->eof = true;
+
+		pthread_mutex_unlock(&play->mutex);
+
+		if (play->eof)
+			break;
+	}
+
+	return NULL;
+}
+
+
+static void destructor(void *arg)
+{
+	struct aumix_play *play = arg;
+
+	if (play->run) {
+
+		pthread_mutex_lock(&play->mutex);
+		play->run = false;
+		pthread_cond_signal(&play->cond);
+		pthread_mutex_unlock(&play->mutex);
+
+		pthread_join(play->thread, NULL);
+
+		pthread_cond_destroy(&play->cond);
+		pthread_mutex_destroy(&play->mutex);
+	}
+
+	mem_deref(play->ringv);
+	mem_deref(play->chunk);
+	mem_deref(play->af);
+}
+
+
+/**
+ * Allocate an announcement player, and start prefetching
+ *
+ * @param playp      Pointer to allocated player
+ * @param af         Audio file, opened for reading (S16LE)
+ * @param frame_size Frame size of the mixer, in samples
+ *
+ * @return 0 for success, otherwise error code
+ *
+ * @note The player takes a reference to the audio file
+ */
+int aumix_play_alloc(struct aumix_play **playp, struct aufile *af,
+		     size_t frame_size)
+{
+	struct aumix_play *play;
+	int err;
+
+	if (!playp || !af || !frame_size)
+		return EINVAL;
+
+	play = mem_zalloc(sizeof(*play), destructor);
+	if (!play)
+		return ENOMEM;
+
+	play->af      = mem_ref(af);
+	play->ringsz  = frame_size * PREFETCH_FRAMES;
+	play->chunksz = frame_size * CHUNK_FRAMES;
+
+	play->ringv = mem_alloc(play->ringsz * 2, NULL);
+	play->chunk = mem_alloc(play->chunksz * 2, NULL);
+	if (!play->ringv || !play->chunk) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = pthread_mutex_init(&play->mutex, NULL);
+	if (err)
+		goto out;
+
+	err = pthread_cond_init(&play->cond, NULL);
+	if (err) {
+		pthread_mutex_destroy(&play->mutex);
+		goto out;
+	}
+
+	play->run = true;
+
+	err = pthread_create(&play->thread, NULL, reader_thread, play);
+	if (err) {
+		play->run = false;
+		pthread_cond_destroy(&play->cond);
+		pthread_mutex_destroy(&play->mutex);
+		goto out;
+	}
+
+ out:
+	if (err)
+		mem_deref(play);
+	else
+		*playp = play;
+
+	return err;
+}
+
+
+/**
+ * Read a frame from an announcement player, never blocks
+ *
+ * @param play  Announcement player
+ * @param sampv Buffer for the frame
+ * @param sampc Number of samples in the frame
+ *
+ * @return 0 if a frame was read, EAGAIN if the prefetch is late (the
+ *         frame is silence), ENODATA at the end of the file
+ */
+int aumix_play_read(struct aumix_play *play, int16_t *sampv, size_t sampc)
+{
+	size_t n, k;
+	int err = 0;
+
+	if (!play || !sampv)
+		return EINVAL;
+
+	pthread_mutex_lock(&play->mutex);
+
+	if (play->fill < sampc && !play->eof) {
+		memset(sampv, 0, sampc * 2);
+		err = EAGAIN;
+		goto out;
+	}
+
+	if (!play->fill) {
+		err = ENODATA;
+		goto out;
+	}
+
+	/* the last frame of the file is padded with silence */
+	n = min(play->fill, sampc);
+
+	k = min(n, play->ringsz - play->rpos);
+
+	memcpy(sampv, &play->ringv[play->rpos], k * 2);
+	memcpy(&sampv[k], play->ringv, (n - k) * 2);
+
+	play->rpos = (play->rpos + n) % play->ringsz;
+
+	memset(sampv + n, 0, (sampc - n) * 2);
+
+	play->fill -= n;
+	pthread_cond_signal(&play->cond);
+
+ out:
+	pthread_mutex_unlock(&play->mutex);
+
+	return err;
+}
@@ -0,0 +1,210 @@
+/**
+ * @file pool.c  Audio Mixer -- worker pool
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <pthread.h>
+#include <re.h>
+#include "aumix.h"
+
+
+/**
+ * Defines a fork-join worker pool
+ *
+ * The thread calling aumix_pool_run() takes part as worker 0, so a pool
+ * of n workers has n-1 threads.
+ */
+struct aumix_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;         /* workers wait for a job   */
+	pthread_cond_t done;         /* caller waits for workers */
+	pthread_t *threadv;
+	unsigned threadc;
+	unsigned started;
+	aumix_job_h *jobh;
+	void *arg;
+	unsigned gen;
+	unsigned pending;
+	bool run;
+};
+
+struct worker {
+	struct aumix_pool *pool;
+	unsigned idx;
+};
+
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	struct aumix_pool *pool = w->pool;
+	const unsigned idx = w->idx;
+	unsigned gen = 0;
+
+	mem_deref(w);
+
+	pthread_mutex_lock(&pool->mutex);
+
+	for (;;) {
+
+		aumix_job_h *jobh;
+		void *jarg;
+
+		while (pool->run && pool->gen == gen)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+
+		if (!pool->run)
+			break;
+
+		gen  = pool->gen;
+		jobh = pool->jobh;
+		jarg = pool->arg;
+
+		pthread_mutex_unlock(&pool->mutex);
+
+		jobh(idx, pool->threadc + 1, jarg);
+
+		pthread_mutex_lock(&pool->mutex);
+
+		if (--pool->pending == 0)
+			pthread_cond_signal(&pool->done);
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+
+static void pool_destructor(void *arg)
+{
+	struct aumix_pool *pool = arg;
+	unsigned i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->run = false;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i=0; i<pool->started; i++)
+		pthread_join(pool->threadv[i], NULL);
+
+	mem_deref(pool->threadv);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+}
+
+
+/**
+ * Allocate a worker pool
+ *
+ * @param poolp Pointer to allocated worker pool
+ * @param n     Number of workers, including the calling thread
+ *
+ * @return 0 for success, otherwise error code
+ */
+int aumix_pool_alloc(struct aumix_pool **poolp, unsigned n)
+{
+	struct aumix_pool *pool;
+	unsigned i;
+	int err = 0;
+
+	if (!poolp || n < 2)
+		return EINVAL;
+
+	pool = mem_zalloc(sizeof(*pool), pool_destructor);
+	if (!pool)
+		return ENOMEM;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	pool->threadv = mem_zalloc((n - 1) * sizeof(*pool->threadv), NULL);
+	if (!pool->threadv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	pool->threadc = n - 1;
+	pool->run     = true;
+
+	for (i=0; i<pool->threadc; i++) {
+
+		struct worker *w = mem_zalloc(sizeof(*w), NULL);
+		if (!w) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		w->pool = pool;
+		w->idx  = i + 1;
+
+		err = pthread_create(&pool->threadv[i], NULL,
+				     worker_thread, w);
+		if (err) {
+			mem_deref(w);
+			goto out;
+		}
+
+		++pool->started;
+	}
+
+ out:
+	if (err)
+		mem_deref(pool);
+	else
+		*poolp = pool;
+
+	return err;
+}
+
+
+/**
+ * Run a job on all workers and wait for it to complete
+ *
+ * @param pool Worker pool, or NULL to run the job in the calling thread
+ * @param jobh Job handler, called once per worker
+ * @param arg  Handler argument
+ */
+void aumix_pool_run(struct aumix_pool *pool, aumix_job_h *jobh, void *arg)
+{
+	if (!jobh)
+		return;
+
+	if (!pool) {
+		jobh(0, 1, arg);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->jobh    = jobh;
+	pool->arg     = arg;
+	pool->pending = pool->threadc;
+	++pool->gen;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	jobh(0, pool->threadc + 1, arg);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->pending)
+		pthread_cond_wait(&pool->done, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+
+/**
+ * Get the number of workers in a worker pool
+ *
+ * @param pool Worker pool
+ *
+ * @return Number of workers, including the calling thread
+ */
+unsigned aumix_pool_size(const struct aumix_pool *pool)
+{
+	return pool ? pool->threadc + 1 : 1;
+}
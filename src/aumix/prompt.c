@@ -0,0 +1,308 @@
+/**
+ * @file prompt.c  Audio Mixer -- shared cache of decoded prompts
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <re.h>
+#include <rem_au.h>
+#include <rem_aufile.h>
+#include <rem_auconv.h>
+#include <rem_g711.h>
+#include <rem_fir.h>
+#include <rem_auresamp.h>
+#include "aumix.h"
+
+
+enum {
+	PROMPT_MAX_SIZE = 8 * 1024 * 1024,  /* Max. file size cached [bytes] */
+};
+
+
+/**
+ * Defines a cached prompt, decoded to S16 PCM in a mixer format
+ *
+ * The samples are never changed after decoding, so any number of mixers
+ * can play from the same prompt at the same time.
+ */
+struct aumix_prompt {
+	struct le le;
+	char *path;
+	time_t mtime;
+	uint32_t srate;
+	uint8_t ch;
+	int16_t *sampv;
+	size_t sampc;
+};
+
+
+/*
+ * The cache holds all prompts that are in use. All references to a
+ * prompt are taken and released with the cache lock held.
+ */
+static struct list promptl = LIST_INIT;
+static pthread_mutex_t prompt_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void destructor(void *arg)
+{
+	struct aumix_prompt *p = arg;
+
+	list_unlink(&p->le);
+	mem_deref(p->sampv);
+	mem_deref(p->path);
+}
+
+
+static struct aumix_prompt *prompt_find(const char *path, time_t mtime,
+					uint32_t srate, uint8_t ch)
+{
+	struct le *le;
+
+	for (le=promptl.head; le; le=le->next) {
+
+		struct aumix_prompt *p = le->data;
+
+		if (p->mtime == mtime && p->srate == srate && p->ch == ch &&
+		    !str_cmp(p->path, path))
+			return p;
+	}
+
+	return NULL;
+}
+
+
+/* Convert the file samples to S16 */
+static void to_s16(int16_t *sampv, enum aufmt fmt, uint8_t *buf, size_t n)
+{
+	size_t i;
+
+	switch (fmt) {
+
+	case AUFMT_S16LE:
+		memcpy(sampv, buf, n * 2);
+		break;
+
+	case AUFMT_PCMA:
+		for (i=0; i<n; i++)
+			sampv[i] = g711_alaw2pcm(buf[i]);
+		break;
+
+	case AUFMT_PCMU:
+		for (i=0; i<n; i++)
+			sampv[i] = g711_ulaw2pcm(buf[i]);
+		break;
+
+	default:
+		auconv_to_s16(sampv, fmt, buf, n);
+		break;
+	}
+}
+
+
+/* Read the whole file, and decode it to the format of the prompt */
+static int prompt_decode(struct aumix_prompt *p, size_t fsize)
+{
+	struct aufile_prm prm;
+	struct aufile *af;
+	struct auresamp rs;
+	uint8_t *buf = NULL;
+	int16_t *sampv = NULL, *outv = NULL;
+	size_t ssz, sz = 0, n, sampc, outc;
+	int err;
+
+	err = aufile_open(&af, &prm, p->path, AUFILE_READ);
+	if (err)
+		return err;
+
+	auresamp_init(&rs);
+
+	ssz = aufmt_sample_size(prm.fmt);
+	if (!ssz) {
+		err = ENOTSUP;
+		goto out;
+	}
+
+	err = auresamp_setup(&rs, prm.srate, prm.channels, p->srate, p->ch);
+	if (err)
+		goto out;
+
+	/* the audio data is never larger than the file */
+	buf = mem_alloc(fsize + 1, NULL);
+	if (!buf) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	do {
+		n = fsize + 1 - sz;
+
+		err = aufile_read(af, buf + sz, &n);
+		if (err)
+			goto out;
+
+		sz += n;
+
+	} while (n && sz <= fsize);
+
+	sampc = sz / ssz;
+	sampc -= sampc % prm.channels;
+
+	sampv = mem_alloc(max(sampc, 1) * 2, NULL);
+	if (!sampv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	to_s16(sampv, prm.fmt, buf, sampc);
+
+	if (!rs.resample) {
+		p->sampv = sampv;
+		p->sampc = sampc;
+		sampv = NULL;
+		goto out;
+	}
+
+	outc = max(sampc, (uint64_t)sampc * p->srate * p->ch /
+		   ((uint64_t)prm.srate * prm.channels) + p->ch);
+
+	outv = mem_alloc(outc * 2, NULL);
+	if (!outv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = auresamp(&rs, outv, &outc, sampv, sampc);
+	if (err)
+		goto out;
+
+	p->sampv = outv;
+	p->sampc = outc;
+	outv = NULL;
+
+ out:
+	auresamp_reset(&rs);
+	mem_deref(outv);
+	mem_deref(sampv);
+	mem_deref(buf);
+	mem_deref(af);
+
+	return err;
+}
+
+
+/**
+ * Get a decoded prompt from the cache, or decode and add it
+ *
+ * @param pp    Pointer to the prompt, release with aumix_prompt_put()
+ * @param path  Filename of the audio file with complete path
+ * @param srate Sample rate of the mixer
+ * @param ch    Number of channels of the mixer
+ *
+ * @return 0 for success, EFBIG if the file is too large to be cached,
+ *         otherwise error code
+ */
+int aumix_prompt_get(struct aumix_prompt **pp, const char *path,
+		     uint32_t srate, uint8_t ch)
+{
+	struct aumix_prompt *p, *dup;
+	struct stat st;
+	int err;
+
+	if (!pp || !path)
+		return EINVAL;
+
+	if (stat(path, &st))
+		return errno;
+
+	if (st.st_size > PROMPT_MAX_SIZE)
+		return EFBIG;
+
+	pthread_mutex_lock(&prompt_mutex);
+	p = mem_ref(prompt_find(path, st.st_mtime, srate, ch));
+	pthread_mutex_unlock(&prompt_mutex);
+
+	if (p) {
+		*pp = p;
+		return 0;
+	}
+
+	/* decode without the lock held, other prompts can be used */
+	p = mem_zalloc(sizeof(*p), destructor);
+	if (!p)
+		return ENOMEM;
+
+	p->mtime = st.st_mtime;
+	p->srate = srate;
+	p->ch    = ch;
+
+	err = str_dup(&p->path, path);
+	if (err)
+		goto out;
+
+	err = prompt_decode(p, (size_t)st.st_size);
+	if (err)
+		goto out;
+
+	pthread_mutex_lock(&prompt_mutex);
+
+	/* decoded by someone else in the meantime */
+	dup = mem_ref(prompt_find(path, st.st_mtime, srate, ch));
+	if (!dup)
+		list_append(&promptl, &p->le, p);
+
+	pthread_mutex_unlock(&prompt_mutex);
+
+	if (dup) {
+		mem_deref(p);
+		p = dup;
+	}
+
+ out:
+	if (err)
+		mem_deref(p);
+	else
+		*pp = p;
+
+	return err;
+}
+
+
+/**
+ * Release a prompt, it is removed from the cache when no longer used
+ *
+ * @param p Prompt
+ */
+void aumix_prompt_put(struct aumix_prompt *p)
+{
+	if (!p)
+		return;
+
+	pthread_mutex_lock(&prompt_mutex);
+	mem_deref(p);
+	pthread_mutex_unlock(&prompt_mutex);
+}
+
+
+/**
+ * Get the samples of a prompt
+ *
+ * @param p     Prompt
+ * @param sampc Returns the number of samples
+ *
+ * @return Samples in the mixer format
+ */
+const int16_t *aumix_prompt_samp(const struct aumix_prompt *p,
+				 size_t *sampc)
+{
+	if (!p || !sampc)
+		return NULL;
+
+	*sampc = p->sampc;
+
+	return p->sampv;
+}
@@ -0,0 +1,59 @@
+/**
+ * @file auresamp/auresamp.h  Audio Resampler -- internal API
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/*
+ * L/M polyphase filter
+ */
+
+/** Largest interpolation factor L, the taps are L x N */
+#define AURESAMP_POLY_LMAX 1024
+
+/** Frames that are downmixed at a time, before the filter */
+#define AURESAMP_POLY_BLOCK 128
+
+int  auresamp_poly_get(struct auresamp_poly **pp, const int16_t **tapv,
+		       size_t *n, unsigned l, unsigned m,
+		       enum auresamp_quality q);
+void auresamp_poly_put(struct auresamp_poly *p);
+int  auresamp_poly(struct auresamp *rs, int16_t *outv, size_t *outc,
+		   const int16_t *inv, size_t inc);
+
+
+/*
+ * Channel remix
+ */
+
+/* n frames, with a matrix of och x ich gains in Q14 */
+static inline void auresamp_remix(const int16_t *mixv, int16_t *outv,
+				  unsigned och, const int16_t *inv,
+				  unsigned ich, size_t n)
+{
+	unsigned i, o;
+
+	while (n--) {
+
+		for (o=0; o<och; o++) {
+
+			const int16_t *g = &mixv[o * ich];
+			int32_t acc = 0;
+
+			for (i=0; i<ich; i++)
+				acc += (int32_t)g[i] * inv[i];
+
+			acc >>= 14;
+
+			if (acc > 32767)
+				acc = 32767;
+			else if (acc < -32768)
+				acc = -32768;
+
+			*outv++ = (int16_t)acc;
+		}
+
+		inv += ich;
+	}
+}
@@ -5,3 +5,4 @@
 #
 
 SRCS	+= auresamp/resamp.c
+SRCS	+= auresamp/poly.c
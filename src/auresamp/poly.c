@@ -0,0 +1,384 @@
+/**
+ * @file poly.c  Audio Resampler -- L/M polyphase filter
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <math.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <re.h>
+#include <rem_fir.h>
+#include <rem_auresamp.h>
+#include "auresamp.h"
+
+
+/*
+ * The input is conceptually upsampled by L, low-pass filtered and
+ * downsampled by M. Only the outputs that are kept are computed, and
+ * only with the taps that meet non-zero input samples, so each output
+ * sample is a dot product of N input frames with one of the L phases of
+ * the prototype filter. The dot products are those of the FIR kernels,
+ * over a linear buffer of each channel.
+ *
+ * The prototype filter is a Kaiser-windowed sinc, designed for L, M and
+ * the quality level. It is designed once, and shared by the resamplers
+ * that use it, in a process-wide cache. The resamplers count the
+ * references under the cache mutex, and the last one frees the filter.
+ */
+
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+/** Defines the filter design of a quality level */
+struct quality {
+	unsigned zc;      /* Zero crossings on each side, at the lower rate */
+	double att;       /* Stopband attenuation in [dB]                   */
+};
+
+static const struct quality qualityv[] = {
+	{ 8, 50.0},   /* AURESAMP_QUALITY_LOW    */
+	{16, 70.0},   /* AURESAMP_QUALITY_MEDIUM */
+	{32, 90.0},   /* AURESAMP_QUALITY_HIGH   */
+};
+
+
+/** Defines a cached polyphase filter */
+struct auresamp_poly {
+	struct le le;
+	unsigned l, m;
+	enum auresamp_quality q;
+	unsigned refs;    /* resamplers using it, under the mutex */
+	size_t n;
+	int16_t tapv[];   /* L phases of N taps, in input order */
+};
+
+
+static struct list polyl = LIST_INIT;
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t poly_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+/* Modified Bessel function of the first kind, order zero */
+static double bessel_i0(double x)
+{
+	double sum = 1.0, t = 1.0;
+	unsigned k;
+
+	for (k=1; k<50; k++) {
+
+		t *= (x / (2 * k)) * (x / (2 * k));
+		sum += t;
+
+		if (t < sum * 1e-12)
+			break;
+	}
+
+	return sum;
+}
+
+
+static inline int16_t saturate(double h)
+{
+	h = h < 0 ? h - 0.5 : h + 0.5;
+
+	if (h > 32767.0)
+		return 32767;
+	else if (h < -32768.0)
+		return -32768;
+
+	return (int16_t)h;
+}
+
+
+/*
+ * Kaiser-windowed sinc, with a gain of L, quantized to Q15
+ *
+ * The length follows from the quality level, the transition band from
+ * the length and the stopband attenuation. The stopband starts at the
+ * lower Nyquist frequency, so nothing aliases into the passband.
+ *
+ * Tap k of the prototype is tap k / L of phase k % L. The taps of a
+ * phase are reversed, to run over the input from the oldest to the
+ * newest frame.
+ */
+static void poly_design(struct auresamp_poly *p)
+{
+	const double att = qualityv[p->q].att;
+	const size_t len = p->n * p->l;
+	const double fn = 0.5 / max(p->l, p->m);
+	const double mid = (double)(len - 1) / 2;
+	double beta, df, fc, i0b;
+	size_t k;
+
+	if (att > 50.0)
+		beta = 0.1102 * (att - 8.7);
+	else
+		beta = 0.5842 * pow(att - 21.0, 0.4) + 0.07886 * (att - 21.0);
+
+	/* transition width in cycles per sample, at L times the input */
+	df = (att - 7.95) / (14.36 * (double)(len - 1));
+
+	fc  = max(fn - df / 2, fn / 2);
+	i0b = bessel_i0(beta);
+
+	for (k=0; k<len; k++) {
+
+		const double t = (double)k - mid;
+		const double r = t / mid;
+		double h, w;
+
+		w = bessel_i0(beta * sqrt(max(1.0 - r * r, 0.0))) / i0b;
+
+		h = 2 * fc;
+		if (t != 0.0)
+			h = sin(2 * M_PI * fc * t) / (M_PI * t);
+
+		p->tapv[(k % p->l) * p->n + p->n - 1 - k / p->l] =
+			saturate(h * w * p->l * 32768.0);
+	}
+}
+
+
+/**
+ * Get the polyphase filter for a resampling ratio
+ *
+ * @param pp   Returns the filter, release with auresamp_poly_put()
+ * @param tapv Returns the taps, L phases of N taps
+ * @param n    Returns the number of taps per phase N
+ * @param l    Interpolation factor L
+ * @param m    Decimation factor M
+ * @param q    Quality level
+ *
+ * @return 0 if success, otherwise error code
+ */
+int auresamp_poly_get(struct auresamp_poly **pp, const int16_t **tapv,
+		      size_t *n, unsigned l, unsigned m,
+		      enum auresamp_quality q)
+{
+	struct auresamp_poly *p = NULL;
+	struct le *le;
+	size_t taps;
+	int err = 0;
+
+	if (!pp || !tapv || !n || !l || !m ||
+	    (unsigned)q >= ARRAY_SIZE(qualityv))
+		return EINVAL;
+
+	/* the zero crossings are at the lower rate, downsampling needs
+	   more input frames for the same filter */
+	taps = (2 * (size_t)qualityv[q].zc * max(l, m) + l - 1) / l;
+	taps = min(taps, (size_t)AURESAMP_POLY_TAPS);
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&poly_mutex);
+#endif
+
+	for (le=polyl.head; le; le=le->next) {
+
+		struct auresamp_poly *c = le->data;
+
+		if (c->l == l && c->m == m && c->q == q) {
+			p = c;
+			break;
+		}
+	}
+
+	if (!p) {
+		p = mem_zalloc(sizeof(*p) + (size_t)l * taps * sizeof(int16_t),
+			       NULL);
+		if (!p) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		p->l = l;
+		p->m = m;
+		p->q = q;
+		p->n = taps;
+
+		poly_design(p);
+
+		list_append(&polyl, &p->le, p);
+	}
+
+	++p->refs;
+
+	*pp   = p;
+	*tapv = p->tapv;
+	*n    = p->n;
+
+ out:
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&poly_mutex);
+#endif
+
+	return err;
+}
+
+
+/**
+ * Release a polyphase filter, it is freed when no resampler uses it
+ *
+ * @param p Filter from auresamp_poly_get(), or NULL
+ */
+void auresamp_poly_put(struct auresamp_poly *p)
+{
+	if (!p)
+		return;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&poly_mutex);
+#endif
+
+	if (!--p->refs) {
+		list_unlink(&p->le);
+		mem_deref(p);
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&poly_mutex);
+#endif
+}
+
+
+static inline int16_t poly_out(int64_t acc)
+{
+	acc >>= 15;
+
+	if (acc > 32767)
+		return 32767;
+	else if (acc < -32768)
+		return -32768;
+
+	return (int16_t)acc;
+}
+
+
+/*
+ * Filter n frames of ch channels, at most a block. With a matrix, each
+ * output frame is remixed from the ch = ich filtered channels.
+ *
+ * Each channel has a linear buffer of N - 1 history frames followed by
+ * a block of input, so the taps of an output are contiguous.
+ *
+ * Returns the number of output frames.
+ */
+static size_t poly_run(struct auresamp *rs, fir_dot_h *dot, int16_t *outv,
+		       const int16_t *inv, size_t n, unsigned ch, bool remix)
+{
+	const size_t tapc = rs->polyc, h = tapc - 1;
+	const size_t s = h + AURESAMP_POLY_BLOCK;
+	const size_t end = h + n;
+	const unsigned och = rs->och;
+	int16_t y[AURESAMP_MAX_CH];
+	size_t i, outcc = 0;
+	unsigned c;
+
+	for (c=0; c<ch; c++) {
+
+		int16_t *x = &rs->histv[c * s + h];
+
+		for (i=0; i<n; i++)
+			x[i] = inv[i * ch + c];
+	}
+
+	/* the input positions are counted from the oldest history frame */
+	while (rs->pos < end) {
+
+		const int16_t *x = &rs->histv[rs->pos - h];
+		const int16_t *hv = &rs->polyv[rs->phase * tapc];
+		int16_t *yv = remix ? y : outv;
+
+		for (c=0; c<ch; c++)
+			yv[c] = poly_out(dot(&x[c * s], hv, tapc));
+
+		if (remix)
+			rs->resample(rs, outv, y, 1);
+
+		outv += och;
+		++outcc;
+
+		rs->phase += rs->m;
+		rs->pos   += rs->phase / rs->l;
+		rs->phase %= rs->l;
+	}
+
+	/* keep the last N - 1 frames */
+	for (c=0; c<ch; c++) {
+		memmove(&rs->histv[c * s], &rs->histv[c * s + n],
+			h * sizeof(int16_t));
+	}
+
+	rs->pos -= n;
+
+	return outcc;
+}
+
+
+/**
+ * Resample with the polyphase filter
+ *
+ * The input history is kept in the resampler, so the input can be
+ * split in blocks of any size.
+ *
+ * The input is filtered in blocks that stay in the cache. A downmix is
+ * done before the filter, so that only the output channels are filtered.
+ * Otherwise the output frames are remixed as they are filtered. The
+ * history is kept for the filtered channels only.
+ *
+ * @param rs   Resampler
+ * @param outv Output samples
+ * @param outc Output sample count (in/out)
+ * @param inv  Input samples
+ * @param inc  Input sample count
+ *
+ * @return 0 if success, otherwise error code
+ */
+int auresamp_poly(struct auresamp *rs, int16_t *outv, size_t *outc,
+		  const int16_t *inv, size_t inc)
+{
+	const unsigned ich = rs->ich, och = rs->och;
+	const size_t end = rs->polyc - 1 + inc / ich;
+	size_t incc = inc / ich, outcc = 0;
+	fir_dot_h *dot;
+
+	if (rs->pos < end)
+		outcc = (((end - rs->pos) * rs->l - rs->phase) + rs->m - 1) /
+			rs->m;
+
+	if (*outc < outcc * och)
+		return ENOMEM;
+
+	*outc = outcc * och;
+
+	dot = fir_dot_get();
+
+	while (incc) {
+
+		int16_t mixv[AURESAMP_POLY_BLOCK * AURESAMP_MAX_CH];
+		const size_t n = min(incc, (size_t)AURESAMP_POLY_BLOCK);
+		size_t outn;
+
+		if (och < ich) {
+			rs->resample(rs, mixv, inv, n);
+			outn = poly_run(rs, dot, outv, mixv, n, och, false);
+		}
+		else {
+			outn = poly_run(rs, dot, outv, inv, n, ich, rs->mixed);
+		}
+
+		outv += outn * och;
+
+		inv  += n * ich;
+		incc -= n;
+	}
+
+	return 0;
+}
@@ -6,152 +6,150 @@
 
 #include <string.h>
 #include <re.h>
-#include <rem_fir.h>
 #include <rem_auresamp.h>
+#include "auresamp.h"
 
 
-/* 48kHz sample-rate, 4kHz cutoff (pass 0-3kHz, stop 5-24kHz) */
-static const int16_t fir_48_4[] = {
-	 62,   -176,   -329,   -556,   -802,  -1005,  -1090,   -985,
-       -636,    -23,    826,   1837,   2894,   3859,   4595,   4994,
-       4994,   4595,   3859,   2894,   1837,    826,    -23,   -636,
-       -985,  -1090,  -1005,   -802,   -556,   -329,   -176,     62
-};
-
-/* 48kHz sample-rate, 8kHz cutoff (pass 0-7kHz, stop 9-24kHz) */
-static const int16_t fir_48_8[] = {
-	238,    198,   -123,   -738,  -1268,  -1204,   -380,    714,
-       1164,    376,  -1220,  -2206,  -1105,   2395,   6909,  10069,
-      10069,   6909,   2395,  -1105,  -2206,  -1220,    376,   1164,
-	714,   -380,  -1204,  -1268,   -738,   -123,    198,    238
-};
+/*
+ * Channel remixing, with a matrix of och x ich gains in Q14
+ *
+ * The default matrices assume the WAV channel order, and 5.1 as L, R, C,
+ * LFE, Ls, Rs. A downmix is scaled so that it can not clip.
+ */
 
 
-static void upsample_mono2mono(int16_t *outv, const int16_t *inv,
-			       size_t inc, unsigned ratio)
-{
-	unsigned i;
+#define G_1 AURESAMP_GAIN_UNITY
 
-	while (inc >= 1) {
 
-		for (i=0; i<ratio; i++)
-			*outv++ = *inv;
+/* 5.1 to stereo, ITU-R BS.775 with -3 dB for C and the surrounds,
+   scaled by 1 / (1 + 2 * 0.707) */
+static const int16_t mix_51_stereo[2 * 6] = {
+	6786,    0, 4798, 0, 4798,    0,
+	   0, 6786, 4798, 0,    0, 4798,
+};
 
-		++inv;
-		--inc;
-	}
-}
+/* 5.1 to mono, the average of the stereo downmix */
+static const int16_t mix_51_mono[1 * 6] = {
+	3393, 3393, 4798, 0, 2399, 2399,
+};
 
 
-static void upsample_mono2stereo(int16_t *outv, const int16_t *inv,
-				 size_t inc, unsigned ratio)
+static void remix_copy(const struct auresamp *rs, int16_t *outv,
+		       const int16_t *inv, size_t n)
 {
-	unsigned i;
-
-	ratio *= 2;
-
-	while (inc >= 1) {
-
-		for (i=0; i<ratio; i++)
-			*outv++ = *inv;
-
-		++inv;
-		--inc;
-	}
+	memcpy(outv, inv, n * rs->ich * sizeof(int16_t));
 }
 
 
-static void upsample_stereo2mono(int16_t *outv, const int16_t *inv,
-				 size_t inc, unsigned ratio)
+static void remix_mono2stereo(const struct auresamp *rs, int16_t *outv,
+			      const int16_t *inv, size_t n)
 {
-	unsigned i;
-
-	while (inc >= 2) {
+	size_t i;
+	(void)rs;
 
-		const int16_t s = inv[0]/2 + inv[1]/2;
-
-		for (i=0; i<ratio; i++)
-			*outv++ = s;
-
-		inv += 2;
-		inc -= 2;
+	for (i=0; i<n; i++) {
+		outv[2*i]   = inv[i];
+		outv[2*i+1] = inv[i];
 	}
 }
 
 
-static void upsample_stereo2stereo(int16_t *outv, const int16_t *inv,
-				   size_t inc, unsigned ratio)
+/* the same as the default matrix, 0.5 for each channel */
+static void remix_stereo2mono(const struct auresamp *rs, int16_t *outv,
+			      const int16_t *inv, size_t n)
 {
-	unsigned i;
+	size_t i;
+	(void)rs;
 
-	while (inc >= 2) {
+	for (i=0; i<n; i++)
+		outv[i] = (int16_t)((inv[2*i] + inv[2*i+1]) >> 1);
+}
 
-		for (i=0; i<ratio; i++) {
-			*outv++ = inv[0];
-			*outv++ = inv[1];
-		}
 
-		inv += 2;
-		inc -= 2;
-	}
+static void remix_matrix(const struct auresamp *rs, int16_t *outv,
+			 const int16_t *inv, size_t n)
+{
+	auresamp_remix(rs->mixv, outv, rs->och, inv, rs->ich, n);
 }
 
 
-static void downsample_mono2mono(int16_t *outv, const int16_t *inv,
-				 size_t inc, unsigned ratio)
+static bool mix_identity(const int16_t *mixv, unsigned ich, unsigned och)
 {
-	while (inc >= ratio) {
+	unsigned i, o;
 
-		*outv++ = *inv;
+	if (ich != och)
+		return false;
 
-		inv += ratio;
-		inc -= ratio;
+	for (o=0; o<och; o++) {
+		for (i=0; i<ich; i++) {
+
+			if (mixv[o * ich + i] != (i == o ? G_1 : 0))
+				return false;
+		}
 	}
+
+	return true;
 }
 
 
-static void downsample_mono2stereo(int16_t *outv, const int16_t *inv,
-				   size_t inc, unsigned ratio)
+static void mix_default(int16_t *mixv, unsigned ich, unsigned och)
 {
-	while (inc >= ratio) {
+	unsigned i, o;
 
-		*outv++ = *inv;
-		*outv++ = *inv;
+	memset(mixv, 0, ich * och * sizeof(int16_t));
 
-		inv += ratio;
-		inc -= ratio;
+	if (ich == 6 && och == 2) {
+		memcpy(mixv, mix_51_stereo, sizeof(mix_51_stereo));
+	}
+	else if (ich == 6 && och == 1) {
+		memcpy(mixv, mix_51_mono, sizeof(mix_51_mono));
+	}
+	else if (och == 1) {
+		/* equal weights, stereo to mono at -6 dB */
+		for (i=0; i<ich; i++)
+			mixv[i] = (int16_t)(G_1 / ich);
+	}
+	else if (ich == 1) {
+		/* to the front left and right */
+		mixv[0] = G_1;
+		mixv[1] = G_1;
+	}
+	else {
+		/* the channels in common, e.g. stereo to the front of 5.1 */
+		for (o=0; o<min(ich, och); o++)
+			mixv[o * ich + o] = G_1;
 	}
 }
 
 
-static void downsample_stereo2mono(int16_t *outv, const int16_t *inv,
-				   size_t inc, unsigned ratio)
+/*
+ * Not active, if the input is passed through unchanged. The default
+ * mono and stereo conversions have their own handlers, the matrix is
+ * used for other layouts and for a custom matrix.
+ */
+static void set_handler(struct auresamp *rs)
 {
-	ratio *= 2;
+	int16_t mixv[2 * 2];
 
-	while (inc >= ratio) {
-
-		*outv++ = inv[0]/2 + inv[1]/2;
-
-		inv += ratio;
-		inc -= ratio;
+	if (!rs->mixed) {
+		rs->resample = rs->polyv ? remix_copy : NULL;
+		return;
 	}
-}
 
+	rs->resample = remix_matrix;
 
-static void downsample_stereo2stereo(int16_t *outv, const int16_t *inv,
-				     size_t inc, unsigned ratio)
-{
-	ratio *= 2;
+	if (rs->ich > 2 || rs->och > 2)
+		return;
 
-	while (inc >= ratio) {
+	mix_default(mixv, rs->ich, rs->och);
 
-		*outv++ = inv[0];
-		*outv++ = inv[1];
+	if (memcmp(mixv, rs->mixv, rs->ich * rs->och * sizeof(int16_t)))
+		return;
 
-		inv += ratio;
-		inc -= ratio;
-	}
+	if (rs->ich == 1 && rs->och == 2)
+		rs->resample = remix_mono2stereo;
+	else if (rs->ich == 2 && rs->och == 1)
+		rs->resample = remix_stereo2mono;
 }
 
 
@@ -159,6 +157,9 @@ static void downsample_stereo2stereo(int16_t *outv, const int16_t *inv,
  * Initialize a resampler object
  *
  * @param rs Resampler to initialize
+ *
+ * @note A resampler that was set up must be released with
+ *       auresamp_reset() instead
  */
 void auresamp_init(struct auresamp *rs)
 {
@@ -166,14 +167,48 @@ void auresamp_init(struct auresamp *rs)
 		return;
 
 	memset(rs, 0, sizeof(*rs));
-	fir_reset(&rs->fir);
+	rs->quality = AURESAMP_QUALITY_MEDIUM;
+}
+
+
+/**
+ * Reset a resampler object, and release its filter and history
+ *
+ * The resampler is initialized again, and can be set up again.
+ *
+ * @param rs Resampler to reset
+ */
+void auresamp_reset(struct auresamp *rs)
+{
+	if (!rs)
+		return;
+
+	auresamp_poly_put(rs->poly);
+	mem_deref(rs->histv);
+	auresamp_init(rs);
+}
+
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+	while (b) {
+		const uint32_t t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return a;
 }
 
 
 /**
  * Configure a resampler object
  *
- * @note The sample rate ratio must be an integer
+ * The filter is designed for the ratio and the quality level, or taken
+ * from a process-wide cache, and is released by auresamp_reset(). Up to
+ * AURESAMP_MAX_CH channels are supported, with a default remix matrix
+ * when the channel counts differ, see auresamp_set_matrix().
  *
  * @param rs    Resampler
  * @param irate Input sample rate
@@ -186,85 +221,145 @@ void auresamp_init(struct auresamp *rs)
 int auresamp_setup(struct auresamp *rs, uint32_t irate, unsigned ich,
 		   uint32_t orate, unsigned och)
 {
+	struct auresamp_poly *poly = NULL;
+	const int16_t *polyv = NULL;
+	size_t polyc = 1;
+	unsigned l, m;
+	uint32_t g;
+	int err;
+
 	if (!rs || !irate || !ich || !orate || !och)
 		return EINVAL;
 
-	if (orate == irate && och == ich) {
-		auresamp_init(rs);
-		return 0;
-	}
+	if (ich > AURESAMP_MAX_CH || och > AURESAMP_MAX_CH)
+		return ENOTSUP;
 
-	if (orate >= irate) {
+	g = gcd(orate, irate);
+	l = orate / g;
+	m = irate / g;
 
-		if (orate % irate)
-			return ENOTSUP;
+	if (l > AURESAMP_POLY_LMAX)
+		return ENOTSUP;
 
-		if (ich == 1 && och == 1)
-			rs->resample = upsample_mono2mono;
-		else if (ich == 1 && och == 2)
-			rs->resample = upsample_mono2stereo;
-		else if (ich == 2 && och == 1)
-			rs->resample = upsample_stereo2mono;
-		else if (ich == 2 && och == 2)
-			rs->resample = upsample_stereo2stereo;
-		else
-			return ENOTSUP;
+	/* no filter for a channel remix only */
+	if (orate != irate) {
+		err = auresamp_poly_get(&poly, &polyv, &polyc, l, m,
+					rs->quality);
+		if (err)
+			return err;
+	}
 
-		if (!rs->up || orate != rs->orate || och != rs->och)
-			fir_reset(&rs->fir);
+	/* a remix matrix is kept, unless the channels change */
+	if (ich != rs->ich || och != rs->och) {
+		mix_default(rs->mixv, ich, och);
+		rs->mixed = !mix_identity(rs->mixv, ich, och);
+	}
 
-		rs->ratio = orate / irate;
-		rs->up    = true;
+	/* a downmix is filtered after the remix, see auresamp_poly() */
+	if (polyv != rs->polyv || ich != rs->ich || och != rs->och) {
 
-		if (orate == irate) {
-			rs->tapv = NULL;
-			rs->tapc = 0;
-		}
-		else if (orate == 48000 && irate == 16000) {
-			rs->tapv = fir_48_8;
-			rs->tapc = ARRAY_SIZE(fir_48_8);
-		}
-		else {
-			rs->tapv = fir_48_4;
-			rs->tapc = ARRAY_SIZE(fir_48_4);
-		}
-	}
-	else {
-		if (irate % orate)
-			return ENOTSUP;
-
-		if (ich == 1 && och == 1)
-			rs->resample = downsample_mono2mono;
-		else if (ich == 1 && och == 2)
-			rs->resample = downsample_mono2stereo;
-		else if (ich == 2 && och == 1)
-			rs->resample = downsample_stereo2mono;
-		else if (ich == 2 && och == 2)
-			rs->resample = downsample_stereo2stereo;
-		else
-			return ENOTSUP;
-
-		if (rs->up || irate != rs->irate || ich != rs->ich)
-			fir_reset(&rs->fir);
-
-		rs->ratio = irate / orate;
-		rs->up    = false;
-
-		if (irate == 48000 && orate == 16000) {
-			rs->tapv = fir_48_8;
-			rs->tapc = ARRAY_SIZE(fir_48_8);
-		}
-		else {
-			rs->tapv = fir_48_4;
-			rs->tapc = ARRAY_SIZE(fir_48_4);
+		int16_t *histv = NULL;
+
+		if (polyv) {
+			const size_t s = polyc - 1 + AURESAMP_POLY_BLOCK;
+
+			histv = mem_zalloc(s * min(ich, och) * sizeof(int16_t),
+					   NULL);
+			if (!histv) {
+				auresamp_poly_put(poly);
+				return ENOMEM;
+			}
 		}
+
+		mem_deref(rs->histv);
+		rs->histv = histv;
+		rs->phase = 0;
+		rs->pos   = polyc - 1;
 	}
 
+	auresamp_poly_put(rs->poly);
+
+	rs->poly  = poly;
+	rs->polyv = polyv;
+	rs->polyc = polyc;
+	rs->l     = l;
+	rs->m     = m;
+	rs->ratio = max(l, m);
+	rs->up    = orate > irate;
 	rs->orate = orate;
 	rs->och   = och;
 	rs->irate = irate;
 	rs->ich   = ich;
 
+	set_handler(rs);
+
+	return 0;
+}
+
+
+/**
+ * Set the quality of a resampler, the filter is changed if the resampler
+ * is configured already
+ *
+ * @param rs Resampler
+ * @param q  Quality level
+ *
+ * @return 0 if success, otherwise error code
+ */
+int auresamp_set_quality(struct auresamp *rs, enum auresamp_quality q)
+{
+	if (!rs)
+		return EINVAL;
+
+	switch (q) {
+
+	case AURESAMP_QUALITY_LOW:
+	case AURESAMP_QUALITY_MEDIUM:
+	case AURESAMP_QUALITY_HIGH:
+		break;
+
+	default:
+		return EINVAL;
+	}
+
+	rs->quality = q;
+
+	if (!rs->polyv)
+		return 0;
+
+	return auresamp_setup(rs, rs->irate, rs->ich, rs->orate, rs->och);
+}
+
+
+/**
+ * Set the channel remix matrix of a configured resampler
+ *
+ * The remix is done in the resampling pass. The matrix is kept by
+ * auresamp_setup(), unless the channel counts change. A resampler with
+ * the same input and output format is only active with a matrix that
+ * is not the identity.
+ *
+ * @param rs   Resampler
+ * @param mixv Gains in Q14 (AURESAMP_GAIN_UNITY is 1.0), one row of ich
+ *             input gains for each of the och outputs, or NULL for the
+ *             default matrix
+ *
+ * @return 0 if success, otherwise error code
+ */
+int auresamp_set_matrix(struct auresamp *rs, const int16_t *mixv)
+{
+	if (!rs || !rs->ich)
+		return EINVAL;
+
+	if (mixv)
+		memcpy(rs->mixv, mixv, rs->och * rs->ich * sizeof(int16_t));
+	else
+		mix_default(rs->mixv, rs->ich, rs->och);
+
+	rs->mixed = !mix_identity(rs->mixv, rs->ich, rs->och);
+
+	set_handler(rs);
+
 	return 0;
 }
 
@@ -272,7 +367,8 @@ int auresamp_setup(struct auresamp *rs, uint32_t irate, unsigned ich,
 /**
  * Resample
  *
- * @note When downsampling, the input count must be divisible by rate ratio
+ * The input can be split in blocks of any size, the output count
+ * follows the ratio, and is at most one frame more than that.
  *
  * @param rs   Resampler
  * @param outv Output samples
@@ -285,40 +381,22 @@ int auresamp_setup(struct auresamp *rs, uint32_t irate, unsigned ich,
 int auresamp(struct auresamp *rs, int16_t *outv, size_t *outc,
 	     const int16_t *inv, size_t inc)
 {
-	size_t incc, outcc;
+	size_t incc;
 
 	if (!rs || !rs->resample || !outv || !outc || !inv)
 		return EINVAL;
 
-	incc = inc / rs->ich;
-
-	if (rs->up) {
-		outcc = incc * rs->ratio;
-
-		if (*outc < outcc * rs->och)
-			return ENOMEM;
+	if (rs->polyv)
+		return auresamp_poly(rs, outv, outc, inv, inc);
 
-		rs->resample(outv, inv, inc, rs->ratio);
-
-		*outc = outcc * rs->och;
-
-		if (rs->tapv)
-			fir_filter(&rs->fir, outv, outv, *outc, rs->och,
-				   rs->tapv, rs->tapc);
-	}
-	else {
-		outcc = incc / rs->ratio;
-
-		if (*outc < outcc * rs->och || *outc < inc)
-			return ENOMEM;
+	incc = inc / rs->ich;
 
-		fir_filter(&rs->fir, outv, inv, inc, rs->ich,
-			   rs->tapv, rs->tapc);
+	if (*outc < incc * rs->och)
+		return ENOMEM;
 
-		rs->resample(outv, outv, inc, rs->ratio);
+	rs->resample(rs, outv, inv, incc);
 
-		*outc = outcc * rs->och;
-	}
+	*outc = incc * rs->och;
 
 	return 0;
 }
@@ -0,0 +1,178 @@
+/**
+ * @file deadline.c  Periodic deadline scheduler
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#define _BSD_SOURCE 1
+#define _DEFAULT_SOURCE 1
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include <string.h>
+#include <re.h>
+#include <rem_deadline.h>
+
+
+enum {
+	RESYNC_PERIODS = 8,   /* Give up catching up after this many */
+};
+
+#define NSEC_PER_SEC 1000000000ULL
+
+
+/**
+ * Get the current time of the monotonic clock
+ *
+ * @return Current time in [ns]
+ */
+uint64_t deadline_now(void)
+{
+#ifdef WIN32
+	return tmr_jiffies() * 1000000ULL;
+#else
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+#endif
+}
+
+
+static void sleep_until(uint64_t t)
+{
+#if defined (WIN32)
+	const uint64_t now = deadline_now();
+
+	if (t > now)
+		Sleep((DWORD)((t - now + 999999) / 1000000));
+#elif defined (__APPLE__)
+	uint64_t now = deadline_now();
+
+	while (t > now) {
+
+		struct timespec ts;
+
+		ts.tv_sec  = (time_t)((t - now) / NSEC_PER_SEC);
+		ts.tv_nsec = (long)((t - now) % NSEC_PER_SEC);
+
+		(void)nanosleep(&ts, NULL);
+
+		now = deadline_now();
+	}
+#else
+	struct timespec ts;
+
+	ts.tv_sec  = (time_t)(t / NSEC_PER_SEC);
+	ts.tv_nsec = (long)(t % NSEC_PER_SEC);
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+	       == EINTR)
+		;
+#endif
+}
+
+
+/**
+ * Initialize a deadline scheduler, the first deadline is now
+ *
+ * @param dl     Deadline scheduler
+ * @param period Period in [ns]
+ */
+void deadline_init(struct deadline *dl, uint64_t period)
+{
+	if (!dl)
+		return;
+
+	memset(dl, 0, sizeof(*dl));
+
+	dl->next   = deadline_now();
+	dl->period = period;
+}
+
+
+/**
+ * Change the period of a deadline scheduler, from the next deadline
+ *
+ * @param dl     Deadline scheduler
+ * @param period Period in [ns]
+ */
+void deadline_set_period(struct deadline *dl, uint64_t period)
+{
+	if (!dl)
+		return;
+
+	dl->period = period;
+}
+
+
+/**
+ * Sleep until the next deadline, and schedule the one after it
+ *
+ * If the caller is behind schedule, this returns at once so that the
+ * caller can catch up. When more than a few periods behind, the
+ * schedule is restarted from the current time instead.
+ *
+ * @param dl Deadline scheduler
+ *
+ * @return Lateness of this wakeup in [ns]
+ */
+uint64_t deadline_wait(struct deadline *dl)
+{
+	uint64_t now, late = 0;
+
+	if (!dl)
+		return 0;
+
+	now = deadline_now();
+
+	if (now < dl->next) {
+		sleep_until(dl->next);
+		now = deadline_now();
+	}
+
+	if (now > dl->next)
+		late = now - dl->next;
+
+	++dl->ticks;
+	dl->late_sum += late;
+	dl->late_max  = max(dl->late_max, late);
+
+	if (late >= dl->period)
+		++dl->missed;
+
+	dl->next += dl->period;
+
+	if (now > dl->next + RESYNC_PERIODS * dl->period) {
+		dl->next = now + dl->period;
+		++dl->resyncs;
+	}
+
+	return late;
+}
+
+
+/**
+ * Deadline scheduler debug handler, use with fmt %H
+ *
+ * @param pf Print function
+ * @param dl Deadline scheduler
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int deadline_debug(struct re_printf *pf, const struct deadline *dl)
+{
+	if (!dl)
+		return 0;
+
+	return re_hprintf(pf, "period=%lluus ticks=%llu missed=%llu"
+			  " resyncs=%llu late_avg=%lluus late_max=%lluus",
+			  dl->period / 1000, dl->ticks, dl->missed,
+			  dl->resyncs,
+			  dl->ticks ? dl->late_sum / dl->ticks / 1000 : 0,
+			  dl->late_max / 1000);
+}
@@ -7,6 +7,88 @@
 #include <string.h>
 #include <re.h>
 #include <rem_fir.h>
+#include "fir.h"
+
+
+static int64_t c_dot(const int16_t *x, const int16_t *h, size_t n)
+{
+	int64_t acc = 0;
+	size_t i;
+
+	for (i=0; i<n; i++)
+		acc += (int32_t)x[i] * h[i];
+
+	return acc;
+}
+
+
+static size_t c_filter(int16_t *hist, size_t s, size_t p, int16_t *outv,
+		       const int16_t *inv, size_t n, unsigned ch,
+		       const int16_t *tapv, size_t tapc)
+{
+	return fir_run(c_dot, hist, s, p, outv, inv, n, ch, tapv, tapc);
+}
+
+
+const struct fir_kern fir_kern_c = {
+	"c",
+	c_dot,
+	c_filter,
+};
+
+
+#ifdef FIR_KERN_X86
+static const struct fir_kern *kern_x86(void)
+{
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		return &fir_kern_avx2;
+
+	if (__builtin_cpu_supports("sse2"))
+		return &fir_kern_sse2;
+
+	return &fir_kern_c;
+}
+#endif
+
+
+/**
+ * Get the fastest FIR filter kernels for this CPU
+ *
+ * The CPU features are checked on the first call only.
+ *
+ * @return FIR filter kernels
+ */
+const struct fir_kern *fir_kern_get(void)
+{
+#ifdef FIR_KERN_X86
+	static const struct fir_kern *kern;
+	const struct fir_kern *k = __atomic_load_n(&kern, __ATOMIC_RELAXED);
+
+	if (!k) {
+		k = kern_x86();
+		__atomic_store_n(&kern, k, __ATOMIC_RELAXED);
+	}
+
+	return k;
+#elif defined (HAVE_NEON)
+	return &fir_kern_neon;
+#else
+	return &fir_kern_c;
+#endif
+}
+
+
+/**
+ * Get the fastest dot product for this CPU
+ *
+ * @return Dot product of samples and taps
+ */
+fir_dot_h *fir_dot_get(void)
+{
+	return fir_kern_get()->dot;
+}
 
 
 /**
@@ -26,12 +108,12 @@ void fir_reset(struct fir *fir)
 /**
  * Process samples with the FIR filter
  *
- * @note product of channel and tap-count must be power of two
+ * @note product of channel and tap-count must be at most FIR_MAX_TAPS
  *
  * @param fir  FIR filter
  * @param outv Output samples
  * @param inv  Input samples
- * @param inc  Number of samples
+ * @param inc  Number of samples, a multiple of the channel count
  * @param ch   Number of channels
  * @param tapv Filter taps
  * @param tapc Number of taps
@@ -39,29 +121,27 @@ void fir_reset(struct fir *fir)
 void fir_filter(struct fir *fir, int16_t *outv, const int16_t *inv, size_t inc,
 		unsigned ch, const int16_t *tapv, size_t tapc)
 {
-	const unsigned hmask = (ch * (unsigned)tapc) - 1;
+	const struct fir_kern *kern;
+	size_t s, p = 0, n;
+	unsigned c;
 
 	if (!fir || !outv || !inv || !ch || !tapv || !tapc)
 		return;
 
-	if (hmask >= ARRAY_SIZE(fir->history) || hmask & (hmask+1))
+	if (ch * tapc > FIR_MAX_TAPS)
 		return;
 
-	while (inc--) {
-
-		int64_t acc = 0;
-		unsigned i, j;
-
-		fir->history[fir->index & hmask] = *inv++;
+	kern = fir_kern_get();
+	s    = FIR_MAX_TAPS / ch;
+	n    = inc / ch;
 
-		for (i=0, j=fir->index++; i<tapc; ++i, j-=ch)
-			acc += (int64_t)fir->history[j & hmask] * tapv[i];
+	/* the channels are independent, each is filtered in one pass */
+	for (c=0; c<ch; c++) {
 
-		if (acc > 0x3fffffff)
-			acc = 0x3fffffff;
-		else if (acc < -0x40000000)
-			acc = -0x40000000;
-
-		*outv++ = (int16_t)(acc>>15);
+		p = kern->filter(&fir->history[c * 2 * s], s,
+				 s - 1 - fir->index % s, outv + c, inv + c,
+				 n, ch, tapv, tapc);
 	}
+
+	fir->index = (unsigned)(s - 1 - p);
 }
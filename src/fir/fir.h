@@ -0,0 +1,95 @@
+/**
+ * @file fir/fir.h  FIR -- internal API
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+
+/*
+ * The history of each channel is a ring of S = FIR_MAX_TAPS / ch frames,
+ * with the newest frame first. Every frame is written twice, at p and at
+ * p + S, so the last S frames are always contiguous from p upwards, and
+ * line up with the taps without a wrap-around.
+ */
+
+
+/** Defines the FIR filter kernels */
+struct fir_kern {
+	const char *name;
+	fir_dot_h *dot;
+	size_t (*filter)(int16_t *hist, size_t s, size_t p, int16_t *outv,
+			 const int16_t *inv, size_t n, unsigned ch,
+			 const int16_t *tapv, size_t tapc);
+};
+
+extern const struct fir_kern fir_kern_c;
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define FIR_KERN_X86 1
+extern const struct fir_kern fir_kern_sse2;
+extern const struct fir_kern fir_kern_avx2;
+#endif
+
+#ifdef HAVE_NEON
+extern const struct fir_kern fir_kern_neon;
+#endif
+
+const struct fir_kern *fir_kern_get(void);
+
+
+static inline int16_t fir_out(int64_t acc)
+{
+	if (acc > 0x3fffffff)
+		acc = 0x3fffffff;
+	else if (acc < -0x40000000)
+		acc = -0x40000000;
+
+	return (int16_t)(acc>>15);
+}
+
+
+/*
+ * Filter n frames of one channel, from and to interleaved samples. The
+ * kernels call it with their own dot product, which is then a direct
+ * call.
+ *
+ * The history is written a block ahead of the dot products, not one
+ * sample before each, which would stall the vector loads. A block
+ * overwrites only frames older than the taps reach.
+ *
+ * Returns the new history position.
+ */
+static inline size_t fir_run(int64_t (*dot)(const int16_t *x,
+					    const int16_t *h, size_t n),
+			     int16_t *hist, size_t s, size_t p,
+			     int16_t *outv, const int16_t *inv, size_t n,
+			     unsigned ch, const int16_t *tapv, size_t tapc)
+{
+	const size_t blk = s - tapc + 1;
+
+	while (n) {
+
+		const size_t b = min(n, blk);
+		size_t i, q = p;
+
+		for (i=0; i<b; i++) {
+
+			hist[q] = hist[q + s] = *inv;
+			inv += ch;
+
+			q = q ? q - 1 : s - 1;
+		}
+
+		for (i=0; i<b; i++) {
+
+			*outv = fir_out(dot(&hist[p], tapv, tapc));
+			outv += ch;
+
+			p = p ? p - 1 : s - 1;
+		}
+
+		n -= b;
+	}
+
+	return p;
+}
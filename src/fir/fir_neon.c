@@ -0,0 +1,66 @@
+/**
+ * @file fir_neon.c  FIR -- NEON kernels
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <re.h>
+#include <rem_fir.h>
+#include "fir.h"
+
+
+#ifdef HAVE_NEON
+
+#include <arm_neon.h>
+
+
+/*
+ * NEON -- 8 taps per iteration
+ *
+ * The products are summed in 32-bit lanes, which are widened to 64 bits
+ * for the final sum.
+ */
+
+
+static int64_t neon_dot(const int16_t *x, const int16_t *h, size_t n)
+{
+	int32x4_t acc = vdupq_n_s32(0);
+	int64x2_t sum;
+	int64_t r;
+	size_t i;
+
+	for (i=0; i+8 <= n; i+=8) {
+
+		int16x8_t a = vld1q_s16(&x[i]);
+		int16x8_t b = vld1q_s16(&h[i]);
+
+		acc = vmlal_s16(acc, vget_low_s16(a), vget_low_s16(b));
+		acc = vmlal_s16(acc, vget_high_s16(a), vget_high_s16(b));
+	}
+
+	sum = vpaddlq_s32(acc);
+	r   = vgetq_lane_s64(sum, 0) + vgetq_lane_s64(sum, 1);
+
+	for (; i<n; i++)
+		r += (int32_t)x[i] * h[i];
+
+	return r;
+}
+
+
+static size_t neon_filter(int16_t *hist, size_t s, size_t p,
+			  int16_t *outv, const int16_t *inv, size_t n,
+			  unsigned ch, const int16_t *tapv, size_t tapc)
+{
+	return fir_run(neon_dot, hist, s, p, outv, inv, n, ch, tapv, tapc);
+}
+
+
+const struct fir_kern fir_kern_neon = {
+	"neon",
+	neon_dot,
+	neon_filter,
+};
+
+
+#endif
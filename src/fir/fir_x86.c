@@ -0,0 +1,137 @@
+/**
+ * @file fir_x86.c  FIR -- SSE2 and AVX2 kernels
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+
+#include <re.h>
+#include <rem_fir.h>
+#include "fir.h"
+
+
+#ifdef FIR_KERN_X86
+
+#include <immintrin.h>
+
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+
+/*
+ * The products are summed in pairs to 32 bits, and in 32-bit lanes. The
+ * lanes are widened to 64 bits for the final sum, so only a lane that
+ * sums taps with a magnitude of more than 2.0 can overflow.
+ */
+
+
+static inline int64_t tail_dot(const int16_t *x, const int16_t *h, size_t n)
+{
+	int64_t acc = 0;
+
+	while (n--)
+		acc += (int32_t)*x++ * *h++;
+
+	return acc;
+}
+
+
+SSE2 static inline int64_t sse2_sum(__m128i v)
+{
+	int32_t lane[4];
+
+	_mm_storeu_si128((__m128i *)lane, v);
+
+	return (int64_t)lane[0] + lane[1] + lane[2] + lane[3];
+}
+
+
+/*
+ * SSE2 -- 8 taps per iteration
+ */
+
+
+SSE2 static int64_t sse2_dot(const int16_t *x, const int16_t *h, size_t n)
+{
+	__m128i acc = _mm_setzero_si128();
+	size_t i;
+
+	for (i=0; i+8 <= n; i+=8) {
+
+		__m128i a = _mm_loadu_si128((const __m128i *)&x[i]);
+		__m128i b = _mm_loadu_si128((const __m128i *)&h[i]);
+
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(a, b));
+	}
+
+	return sse2_sum(acc) + tail_dot(&x[i], &h[i], n - i);
+}
+
+
+SSE2 static size_t sse2_filter(int16_t *hist, size_t s, size_t p,
+			       int16_t *outv, const int16_t *inv, size_t n,
+			       unsigned ch, const int16_t *tapv, size_t tapc)
+{
+	return fir_run(sse2_dot, hist, s, p, outv, inv, n, ch, tapv, tapc);
+}
+
+
+const struct fir_kern fir_kern_sse2 = {
+	"sse2",
+	sse2_dot,
+	sse2_filter,
+};
+
+
+/*
+ * AVX2 -- 16 taps per iteration
+ */
+
+
+AVX2 static int64_t avx2_dot(const int16_t *x, const int16_t *h, size_t n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	__m128i a, b;
+	size_t i;
+
+	for (i=0; i+16 <= n; i+=16) {
+
+		__m256i u = _mm256_loadu_si256((const __m256i *)&x[i]);
+		__m256i v = _mm256_loadu_si256((const __m256i *)&h[i]);
+
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(u, v));
+	}
+
+	/* 8 more taps, at the 128-bit width */
+	a = _mm256_castsi256_si128(acc);
+	b = _mm256_extracti128_si256(acc, 1);
+
+	if (i+8 <= n) {
+
+		__m128i u = _mm_loadu_si128((const __m128i *)&x[i]);
+		__m128i v = _mm_loadu_si128((const __m128i *)&h[i]);
+
+		a = _mm_add_epi32(a, _mm_madd_epi16(u, v));
+		i += 8;
+	}
+
+	return sse2_sum(a) + sse2_sum(b) + tail_dot(&x[i], &h[i], n - i);
+}
+
+
+AVX2 static size_t avx2_filter(int16_t *hist, size_t s, size_t p,
+			       int16_t *outv, const int16_t *inv, size_t n,
+			       unsigned ch, const int16_t *tapv, size_t tapc)
+{
+	return fir_run(avx2_dot, hist, s, p, outv, inv, n, ch, tapv, tapc);
+}
+
+
+const struct fir_kern fir_kern_avx2 = {
+	"avx2",
+	avx2_dot,
+	avx2_filter,
+};
+
+
+#endif
@@ -5,3 +5,5 @@
 #
 
 SRCS	+= fir/fir.c
+SRCS	+= fir/fir_neon.c
+SRCS	+= fir/fir_x86.c
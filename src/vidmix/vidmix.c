@@ -6,7 +6,6 @@
 
 #define _BSD_SOURCE 1
 #define _DEFAULT_SOURCE 1
-#include <unistd.h>
 #define __USE_UNIX98 1
 #include <pthread.h>
 #include <string.h>
@@ -14,6 +13,7 @@
 #include <rem_vid.h>
 #include <rem_vidconv.h>
 #include <rem_vidmix.h>
+#include <rem_deadline.h>
 
 
 struct vidmix {
@@ -26,6 +26,7 @@ struct vidmix_source {
 	struct le le;
 	pthread_t thread;
 	pthread_mutex_t mutex;
+	struct deadline dl;
 	struct vidframe *frame_tx;
 	struct vidframe *frame_rx;
 	struct vidmix *mix;
@@ -34,7 +35,7 @@ struct vidmix_source {
 	void *focus;
 	bool content_hide;
 	bool focus_full;
-	unsigned fint;
+	uint64_t fint;          /* frame interval in [ns] */
 	bool selfview;
 	bool content;
 	bool clear;
@@ -188,30 +189,30 @@ static void *vidmix_thread(void *arg)
 {
 	struct vidmix_source *src = arg;
 	struct vidmix *mix = src->mix;
-	uint64_t ts = tmr_jiffies();
+	struct deadline dl;
 
 	pthread_mutex_lock(&src->mutex);
 
+	deadline_init(&dl, src->fint);
+
 	while (src->run) {
 
 		unsigned n, rows, idx;
 		struct le *le;
-		uint64_t now;
+		uint64_t ts;
+
+		ts = dl.next / 1000000;
 
 		pthread_mutex_unlock(&src->mutex);
-		(void)usleep(4000);
+		(void)deadline_wait(&dl);
 		pthread_mutex_lock(&src->mutex);
 
-		now = tmr_jiffies();
+		src->dl = dl;
+		deadline_set_period(&dl, src->fint);
 
-		if (ts > now)
+		if (!src->frame_tx)
 			continue;
 
-		if (!src->frame_tx) {
-			ts += src->fint;
-			continue;
-		}
-
 		pthread_rwlock_rdlock(&mix->rwlock);
 
 		if (src->clear) {
@@ -261,8 +262,6 @@ static void *vidmix_thread(void *arg)
 		pthread_rwlock_unlock(&mix->rwlock);
 
 		src->fh((uint32_t)ts * 90, src->frame_tx, src->arg);
-
-		ts += src->fint;
 	}
 
 	pthread_mutex_unlock(&src->mutex);
@@ -275,23 +274,25 @@ static void *content_thread(void *arg)
 {
 	struct vidmix_source *src = arg;
 	struct vidmix *mix = src->mix;
-	uint64_t ts = tmr_jiffies();
+	struct deadline dl;
 
 	pthread_mutex_lock(&src->mutex);
 
+	deadline_init(&dl, src->fint);
+
 	while (src->run) {
 
 		struct le *le;
-		uint64_t now;
+		uint64_t ts;
+
+		ts = dl.next / 1000000;
 
 		pthread_mutex_unlock(&src->mutex);
-		(void)usleep(4000);
+		(void)deadline_wait(&dl);
 		pthread_mutex_lock(&src->mutex);
 
-		now = tmr_jiffies();
-
-		if (ts > now)
-			continue;
+		src->dl = dl;
+		deadline_set_period(&dl, src->fint);
 
 		pthread_rwlock_rdlock(&mix->rwlock);
 
@@ -307,8 +308,6 @@ static void *content_thread(void *arg)
 		}
 
 		pthread_rwlock_unlock(&mix->rwlock);
-
-		ts += src->fint;
 	}
 
 	pthread_mutex_unlock(&src->mutex);
@@ -396,7 +395,7 @@ int vidmix_source_alloc(struct vidmix_source **srcp, struct vidmix *mix,
 		return ENOMEM;
 
 	src->mix     = mem_ref(mix);
-	src->fint    = 1000/fps;
+	src->fint    = 1000000000ULL/fps;
 	src->content = content;
 	src->fh      = fh;
 	src->arg     = arg;
@@ -590,11 +589,36 @@ void vidmix_source_set_rate(struct vidmix_source *src, unsigned fps)
 		return;
 
 	pthread_mutex_lock(&src->mutex);
-	src->fint = 1000/fps;
+	src->fint = 1000000000ULL/fps;
 	pthread_mutex_unlock(&src->mutex);
 }
 
 
+/**
+ * Video mixer source debug handler, use with fmt %H
+ *
+ * @param pf  Print function
+ * @param src Video mixer source
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int vidmix_source_debug(struct re_printf *pf, struct vidmix_source *src)
+{
+	struct deadline dl;
+
+	if (!src)
+		return 0;
+
+	pthread_mutex_lock(&src->mutex);
+	dl = src->dl;
+	pthread_mutex_unlock(&src->mutex);
+
+	return re_hprintf(pf, "vidmix_source: content=%d running=%d"
+			  " schedule: %H\n",
+			  src->content, src->run, deadline_debug, &dl);
+}
+
+
 /**
  * Set video mixer content hide
  *